@@ -0,0 +1,204 @@
+/*
+    Times the lexer and the assembler separately on one input and compares the result against a baseline
+
+    Usage: asm_bench <file.asm> [options]
+        -i <n>                  iterations, the fastest one counts (default 5)
+        -t <n>                  lexer threads (default 1)
+        --baseline <file>       compare against this baseline JSON, exits with 1 on a regression
+        --threshold <p>         allowed slowdown or RSS growth before it counts as a regression (default 0.1)
+        --update-baseline       write the results to the baseline file instead of comparing
+*/
+
+#include <sys/resource.h>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include "assembler.h"
+
+namespace {
+
+    struct Result {
+        size_t tokens = 0;
+        size_t instructions = 0;
+        double lex_seconds = 0;
+        double assemble_seconds = 0;
+        long peak_rss_kb = 0;
+
+        double tokens_per_s() const { return tokens / lex_seconds; }
+        double instructions_per_s() const { return instructions / assemble_seconds; }
+
+        std::string to_json() const {
+            std::ostringstream out;
+            out << "{\n"
+                << "    \"tokens\": " << tokens << ",\n"
+                << "    \"instructions\": " << instructions << ",\n"
+                << "    \"lex_seconds\": " << lex_seconds << ",\n"
+                << "    \"assemble_seconds\": " << assemble_seconds << ",\n"
+                << "    \"tokens_per_s\": " << (size_t)tokens_per_s() << ",\n"
+                << "    \"instructions_per_s\": " << (size_t)instructions_per_s() << ",\n"
+                << "    \"peak_rss_kb\": " << peak_rss_kb << "\n"
+                << "}\n";
+            return out.str();
+        }
+    };
+
+    double seconds_since(std::chrono::steady_clock::time_point start){
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    long peak_rss_kb(){
+        rusage usage {};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    Result run(const std::string& input, int iterations, size_t threads){
+        Result result;
+
+        for(int i = 0; i < iterations; ++i){
+            auto start = std::chrono::steady_clock::now();
+            Assembler::Lexer lexer(input, threads);
+            double lex_seconds = seconds_since(start);
+
+            result.tokens = lexer.get_tokens().size();
+
+            start = std::chrono::steady_clock::now();
+            Assembler::Assembler assembler(lexer.take_tokens(), input);
+            assembler.run();
+            double assemble_seconds = seconds_since(start);
+
+            result.instructions = assembler.get_code().size();
+
+            if((i == 0) || (lex_seconds < result.lex_seconds)) result.lex_seconds = lex_seconds;
+            if((i == 0) || (assemble_seconds < result.assemble_seconds)) result.assemble_seconds = assemble_seconds;
+        }
+
+        result.peak_rss_kb = peak_rss_kb();
+
+        return result;
+    }
+
+    /*
+        value of `"key": <number>` in a flat JSON object, 0 if it isn't there
+    */
+    double json_number(const std::string& json, const std::string& key){
+        size_t pos = json.find("\"" + key + "\"");
+        if(pos == std::string::npos) return 0;
+
+        pos = json.find(':', pos);
+        if(pos == std::string::npos) return 0;
+
+        return std::strtod(json.c_str() + pos + 1, nullptr);
+    }
+
+    /*
+        returns false if any metric is more than `threshold` worse than the baseline
+    */
+    bool compare(const Result& result, const std::string& baseline, double threshold){
+        struct Metric {
+            const char* name;
+            double current;
+            bool higher_is_better;
+        };
+
+        const Metric metrics[] = {
+            {"tokens_per_s", result.tokens_per_s(), true},
+            {"instructions_per_s", result.instructions_per_s(), true},
+            {"peak_rss_kb", (double)result.peak_rss_kb, false},
+        };
+
+        bool ok = true;
+
+        for(const Metric& metric : metrics){
+            double base = json_number(baseline, metric.name);
+
+            if(base <= 0){
+                std::cout << metric.name << ": no baseline" << std::endl;
+                continue;
+            }
+
+            double change = (metric.current - base) / base;
+            bool regressed = metric.higher_is_better ? (change < -threshold) : (change > threshold);
+
+            std::cout << metric.name << ": " << (size_t)metric.current << " vs baseline " << (size_t)base
+                      << " (" << (change >= 0 ? "+" : "") << (int)(change * 100) << "%)"
+                      << (regressed ? " REGRESSION" : "") << std::endl;
+
+            ok = ok && !regressed;
+        }
+
+        return ok;
+    }
+
+}
+
+int main(int argc, char* argv[]){
+    std::string input;
+    std::string baseline_path;
+    int iterations = 5;
+    size_t threads = 1;
+    double threshold = 0.1;
+    bool update_baseline = false;
+
+    for(int i = 1; i < argc; ++i){
+        std::string arg = argv[i];
+        std::string value = (i + 1 < argc) ? argv[i + 1] : "";
+
+        if(arg == "-i"){
+            iterations = std::max(std::atoi(value.c_str()), 1); ++i;
+        } else if (arg == "-t"){
+            threads = std::max(std::atoi(value.c_str()), 1); ++i;
+        } else if (arg == "--baseline"){
+            baseline_path = value; ++i;
+        } else if (arg == "--threshold"){
+            threshold = std::atof(value.c_str()); ++i;
+        } else if (arg == "--update-baseline"){
+            update_baseline = true;
+        } else if ((arg.size() > 1) && (arg[0] == '-')){
+            std::cerr << "Unknown option " << arg << ", see the top of bench/bench.cpp" << std::endl;
+            return 2;
+        } else {
+            input = arg;
+        }
+    }
+
+    if(input.empty()){
+        std::cerr << "Usage: " << argv[0] << " <file.asm> [-i n] [-t n] [--baseline file] [--threshold p] [--update-baseline]" << std::endl;
+        return 2;
+    }
+
+    Assembler::log_level = Assembler::LOG_ERROR;
+
+    Result result;
+
+    try {
+        result = run(input, iterations, threads);
+    } catch (const std::exception& e){
+        std::cerr << input << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << result.to_json();
+
+    if(baseline_path.empty()){
+        return 0;
+    }
+
+    if(update_baseline){
+        std::ofstream(baseline_path) << result.to_json();
+        std::cout << "Baseline written to " << baseline_path << std::endl;
+        return 0;
+    }
+
+    std::ifstream file(baseline_path);
+
+    if(!file){
+        std::cerr << "No baseline at " << baseline_path << ", create one with --update-baseline" << std::endl;
+        return 1;
+    }
+
+    std::string baseline((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    return compare(result, baseline, threshold) ? 0 : 1;
+}
@@ -0,0 +1,254 @@
+/*
+    Generates a synthetic RV64I program for benchmarking the assembler
+
+    Usage: asm_gen [options]
+        -n <count>          number of instructions (default 1000000)
+        --seed <n>          random seed, the same seed gives the same program (default 1)
+        --mix r,i,s,b,u,j   relative weights of the base instruction formats (default 30,35,10,15,5,5)
+        --pseudo <p>        fraction of instructions that are pseudo instructions (default 0.1)
+        --labels <p>        chance of a label before each instruction (default 0.05)
+        --comments <p>      chance of a comment after each instruction, and of a comment line (default 0.1)
+        -o <file>           output file (default stdout)
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+    struct Options {
+        size_t count = 1000000;
+        uint64_t seed = 1;
+        std::vector<double> mix = {30, 35, 10, 15, 5, 5};
+        double pseudo = 0.1;
+        double labels = 0.05;
+        double comments = 0.1;
+        std::string output;
+    };
+
+    const char* const REGISTERS[] = {
+        "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+        "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+        "x0", "x5", "x10", "x31", "fp",
+    };
+
+    const char* const R_TYPE[] = {"add", "sub", "xor", "or", "and", "sll", "srl", "sra", "slt", "sltu", "addw", "subw", "sllw", "srlw", "sraw"};
+    const char* const I_ARITH[] = {"addi", "slti", "sltiu", "xori", "ori", "andi", "addiw"};
+    const char* const I_SHIFT[] = {"slli", "srli", "srai", "slliw", "srliw", "sraiw"};
+    const char* const I_LOAD[] = {"lb", "lh", "lw", "lbu", "lhu", "lwu", "ld"};
+    const char* const S_TYPE[] = {"sb", "sh", "sw", "sd"};
+    const char* const B_TYPE[] = {"beq", "bne", "blt", "bge", "bltu", "bgeu"};
+    const char* const U_TYPE[] = {"lui", "auipc"};
+    const char* const B_PSEUDO[] = {"bgt", "ble", "bgtu", "bleu"};
+    const char* const BZ_PSEUDO[] = {"beqz", "bnez", "bgez", "blez", "bgtz"};
+
+    // branches only go to labels this close, so that offsets stay in range
+    constexpr int LABEL_WINDOW = 8;
+
+    class Generator {
+
+        public:
+            Generator(const Options& _options, std::ostream& _out) :
+                options(_options),
+                out(_out),
+                rng(_options.seed),
+                format(_options.mix.begin(), _options.mix.end())
+            {
+                // labels are numbered up front so that references can go forwards as well as backwards
+                num_labels = std::max<size_t>((size_t)(options.count * options.labels), 1);
+            }
+
+            void run(){
+                out << "# synthetic program, " << options.count << " instructions, seed " << options.seed << "\n";
+
+                size_t next_label = 0;
+
+                for(size_t i = 0; i < options.count; ++i){
+
+                    if((next_label < num_labels) && ((i == 0) || chance(options.labels))){
+                        out << "L" << next_label++ << ":\n";
+                    }
+
+                    current_label = (next_label == 0) ? 0 : next_label - 1;
+
+                    if(chance(options.comments / 2)){
+                        out << "    # comment line " << i << "\n";
+                    }
+
+                    out << "    ";
+
+                    if(chance(options.pseudo)){
+                        pseudo_instr();
+                    } else {
+                        base_instr();
+                    }
+
+                    if(chance(options.comments / 2)){
+                        out << "  # trailing comment";
+                    }
+
+                    out << "\n";
+                }
+
+                // labels that were never placed go at the end, so every reference resolves
+                while(next_label < num_labels){
+                    out << "L" << next_label++ << ":\n";
+                }
+
+                out << "    addi zero, zero, 0\n";
+            }
+
+        private:
+            bool chance(double p){
+                return std::uniform_real_distribution<double>(0, 1)(rng) < p;
+            }
+
+            int uniform(int lo, int hi){
+                return std::uniform_int_distribution<int>(lo, hi)(rng);
+            }
+
+            template<size_t N>
+            const char* pick(const char* const (&names)[N]){
+                return names[uniform(0, N - 1)];
+            }
+
+            const char* reg(){
+                return pick(REGISTERS);
+            }
+
+            std::string imm12(){
+                int value = uniform(-2048, 2047);
+
+                if(chance(0.3) && (value >= 0)){
+                    char buffer[16];
+                    std::snprintf(buffer, sizeof(buffer), "0x%x", value);
+                    return buffer;
+                }
+
+                return std::to_string(value);
+            }
+
+            std::string label(){
+                long target = (long)current_label + uniform(-LABEL_WINDOW, LABEL_WINDOW);
+                target = std::clamp<long>(target, 0, num_labels - 1);
+
+                return "L" + std::to_string(target);
+            }
+
+            void base_instr(){
+                switch(format(rng)){
+                    case 0:
+                        out << pick(R_TYPE) << " " << reg() << ", " << reg() << ", " << reg();
+                        break;
+
+                    case 1:
+                        switch(uniform(0, 2)){
+                            case 0: out << pick(I_ARITH) << " " << reg() << ", " << reg() << ", " << imm12(); break;
+                            case 1: out << pick(I_SHIFT) << " " << reg() << ", " << reg() << ", " << uniform(0, 31); break;
+                            case 2: out << pick(I_LOAD) << " " << reg() << ", " << imm12() << "(" << reg() << ")"; break;
+                        }
+                        break;
+
+                    case 2:
+                        out << pick(S_TYPE) << " " << reg() << ", " << imm12() << "(" << reg() << ")";
+                        break;
+
+                    case 3:
+                        out << pick(B_TYPE) << " " << reg() << ", " << reg() << ", " << label();
+                        break;
+
+                    case 4:
+                        out << pick(U_TYPE) << " " << reg() << ", 0x" << std::hex << uniform(0, 0xfffff) << std::dec;
+                        break;
+
+                    case 5:
+                        out << "jal " << reg() << ", " << label();
+                        break;
+                }
+            }
+
+            void pseudo_instr(){
+                switch(uniform(0, 6)){
+                    case 0: out << "li " << reg() << ", " << imm12(); break;
+                    case 1: out << "li " << reg() << ", 0x" << std::hex << uniform(0, 0x7fffffff) << std::dec; break;
+                    case 2: out << "la " << reg() << ", " << label(); break;
+                    case 3: out << (chance(0.5) ? "mv " : "not ") << reg() << ", " << reg(); break;
+                    case 4: out << "neg " << reg() << ", " << reg(); break;
+                    case 5: out << pick(B_PSEUDO) << " " << reg() << ", " << reg() << ", " << label(); break;
+                    case 6: out << pick(BZ_PSEUDO) << " " << reg() << ", " << label(); break;
+                }
+            }
+
+            const Options& options;
+            std::ostream& out;
+            std::mt19937_64 rng;
+            std::discrete_distribution<int> format;
+
+            size_t num_labels = 1;
+            size_t current_label = 0;
+    };
+
+    std::vector<double> parse_mix(const std::string& text){
+        std::vector<double> mix;
+        size_t start = 0;
+
+        while(start <= text.size()){
+            size_t end = text.find(',', start);
+            if(end == std::string::npos) end = text.size();
+
+            mix.push_back(std::atof(text.substr(start, end - start).c_str()));
+            start = end + 1;
+        }
+
+        return mix;
+    }
+
+}
+
+int main(int argc, char* argv[]){
+    Options options;
+
+    for(int i = 1; i < argc; ++i){
+        std::string arg = argv[i];
+        std::string value = (i + 1 < argc) ? argv[i + 1] : "";
+
+        if(arg == "-n"){
+            options.count = std::strtoull(value.c_str(), nullptr, 10); ++i;
+        } else if (arg == "--seed"){
+            options.seed = std::strtoull(value.c_str(), nullptr, 10); ++i;
+        } else if (arg == "--mix"){
+            options.mix = parse_mix(value); ++i;
+        } else if (arg == "--pseudo"){
+            options.pseudo = std::atof(value.c_str()); ++i;
+        } else if (arg == "--labels"){
+            options.labels = std::atof(value.c_str()); ++i;
+        } else if (arg == "--comments"){
+            options.comments = std::atof(value.c_str()); ++i;
+        } else if (arg == "-o"){
+            options.output = value; ++i;
+        } else {
+            std::cerr << "Unknown option " << arg << ", see the top of bench/generate.cpp" << std::endl;
+            return 2;
+        }
+    }
+
+    if(options.mix.size() != 6){
+        std::cerr << "--mix needs 6 weights: r,i,s,b,u,j" << std::endl;
+        return 2;
+    }
+
+    if(options.output.empty()){
+        Generator(options, std::cout).run();
+    } else {
+        std::ofstream file(options.output);
+        Generator(options, file).run();
+    }
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "assembler.h"
+
+namespace Assembler {
+
+    /*
+        Assembly of source that is already in memory, for embedding the assembler in other programs.
+        Nothing touches the file system and errors come back in the result instead of being thrown
+    */
+    struct Options {
+        // lexer threads, only worth it for sources of several MiB
+        size_t threads = 1;
+        // decode the code again and fail if it differs from the source, see `Assemble_options::verify`
+        bool verify = false;
+        // emit RVC forms, `Result::code` then has 16 bit instructions in the lower half of their word
+        bool compress = false;
+        // `Bitmanip_extension`s `li` may use, see materialize.h
+        uint8_t bitmanip = 0;
+        // literal pools for the numbers `li` would take many instructions for, see `Pool_placement`
+        Pool_placement pools = POOLS_OFF;
+        Pool_policy pool_policy = POOL_FOR_LATENCY;
+    };
+
+    struct Result {
+        bool ok = false;
+        std::vector<U32> code;
+        // words of `code` that are literal pool numbers, not instructions
+        std::vector<Data_range> data;
+        std::vector<Symbol> symbols;
+        // everything that would have been logged, warnings and errors included, as `line:column: error: ...`
+        std::string diagnostics;
+    };
+
+    inline Result assemble(std::string_view source, const Options& options = {}){
+        Result result;
+        std::ostringstream diagnostics;
+
+        Log_streams saved = log_streams;
+        log_streams = Log_streams{&diagnostics, &diagnostics, true, ""};
+
+        try {
+            Lexer lexer(Source_file::borrow(source), options.threads);
+
+            Assembler assembler(lexer.take_tokens());
+            assembler.run(Assemble_options{options.compress, options.bitmanip, options.pools, options.pool_policy, options.verify});
+
+            result.symbols = assembler.get_symbols();
+            result.data = assembler.get_data();
+            result.code = assembler.take_code();
+            result.ok = true;
+
+        } catch (const Fatal_error&){
+            // already in the diagnostics through PANIC
+
+        } catch (const std::exception& e){
+            ERROR(e.what());
+        }
+
+        log_streams = saved;
+        result.diagnostics = diagnostics.str();
+
+        return result;
+    }
+
+}
@@ -1,24 +1,164 @@
 #pragma once
 
+#include <unordered_map>
 #include "lex.h"
+#include "encoder.h"
+#include "compressor.h"
+#include "materialize.h"
+#include "writer.h"
+#include "stats.h"
 
 namespace Assembler {
 
+    /*
+        how a label reference gets patched into an already emitted instruction once the label is known
+    */
+    enum Fixup_kind : uint8_t {
+        FIXUP_B,                // pc relative branch offset
+        FIXUP_J,                // pc relative jump offset
+        FIXUP_PCREL_HI20,       // upper 20 bits of a pc relative offset, for auipc
+        FIXUP_PCREL_LO12_I,     // lower 12 bits of the offset taken by the matching auipc
+        FIXUP_ABS_HI20,         // upper 20 bits of an absolute address, for lui
+        FIXUP_ABS_LO12,         // lower 12 bits of an absolute address
+    };
+
+    struct Fixup {
+        uint32_t index;         // instruction whose immediate is patched
+        uint32_t base_index;    // instruction a pc relative offset is measured from
+        uint32_t target;        // symbol id, or the instruction index of a literal target
+        Fixup_kind kind;
+        bool literal = false;
+    };
+
+    /*
+        short form of a relax item and the long form it grows into when the label is out of its reach
+    */
+    enum Relax_kind : uint8_t {
+        RELAX_BRANCH,           // branch          ->  inverted branch over a jal
+        RELAX_CALL,             // jal ra          ->  auipc ra, jalr ra
+        RELAX_LI,               // addi from zero  ->  lui, addi
+    };
+
+    /*
+        A label operand whose expansion depends on where the label ends up. Parsing emits the one instruction
+        short form, `relax` decides which items need their two instruction long form
+    */
+    struct Relax_item {
+        uint32_t index;         // instruction of the short form
+        uint32_t fixup;         // fixup of the short form, its target is the label
+        Relax_kind kind;
+        bool grown = false;     // known not to fit in the short form
+    };
+
+    /*
+        value for a lui/auipc so that adding the sign extended lower 12 bits of `value` gives `value` back
+    */
+    inline U64 hi20(U64 value){
+        return value + 0x800;
+    }
+
+    inline bool fits_in_signed_12_bits(U64 value){
+        return ((int64_t)value >= -2048) && ((int64_t)value <= 2047);
+    }
+
+    /*
+        reach of branches and jal, both offsets are even
+    */
+    inline bool fits_branch_offset(int64_t offset){
+        return (offset >= -4096) && (offset <= 4094);
+    }
+
+    inline bool fits_jump_offset(int64_t offset){
+        return (offset >= -(1 << 20)) && (offset <= (1 << 20) - 2);
+    }
+
+    /*
+        jal or jalr that doesn't link, control never falls through it
+    */
+    inline bool is_unconditional_jump(const Operands& operands){
+        U32 opcode = operands.base & 0x7f;
+
+        return ((opcode == 0b1101111) || (opcode == 0b1100111)) && (operands.rd == 0);
+    }
+
+    /*
+        where `li` of a number may put the number instead of building it, for auipc and ld to load
+    */
+    enum Pool_placement : uint8_t {
+        POOLS_OFF,
+        POOLS_PER_FUNCTION,     // after the next unconditional jump
+        POOLS_PER_SECTION,      // after the last instruction
+    };
+
+    /*
+        which numbers go into a pool
+    */
+    enum Pool_policy : uint8_t {
+        POOL_FOR_LATENCY,       // the ones `li` takes POOL_MIN_INSTRUCTIONS or more instructions for
+        POOL_FOR_SIZE,          // the ones the load and the number take fewer bytes for than `li`
+    };
+
+    constexpr uint8_t POOL_MIN_INSTRUCTIONS = 5;
+
+    /*
+        A literal pool: two words for each number followed by filler, which `place_pools` moves in front of
+        the numbers as far as it takes to align them to 8 bytes. The numbers have symbols of their own, after
+        the ones of the source, and one more marks the end of the pool for the jump over it
+    */
+    struct Literal_pool {
+        uint32_t first_symbol;  // of the first number, the others follow
+        uint32_t first_number;  // index into the numbers of all pools
+        uint32_t size;          // numbers
+    };
+
+    /*
+        choices that change the code `run` emits for the same source
+    */
+    struct Assemble_options {
+        // emit the 16 bit RVC form of every instruction that has one, see compressor.h
+        bool compress = false;
+        // `Bitmanip_extension`s `li` may use, see materialize.h. The instructions are always accepted
+        uint8_t bitmanip = 0;
+        Pool_placement pools = POOLS_OFF;
+        Pool_policy pool_policy = POOL_FOR_LATENCY;
+        // decode every word again as it is encoded and PANIC if it differs from its record
+        bool verify = false;
+    };
+
     class Assembler {
 
         public:
-            Assembler(std::vector<Token> _tokens, fs::path path) :
-                tokens(_tokens),
-                stream(path.replace_extension(".txt"))
+            /*
+                `path` is only used by `write`, leave it empty to keep the code in memory
+            */
+            Assembler(Token_stream&& _tokens, fs::path path = {}) :
+                output_path(std::move(path)),
+                tokens(std::move(_tokens))
             {
                 num_tokens = tokens.size();
+                symbol_table.resize(tokens.num_symbols(), UNDEFINED_LABEL);
+            }
+
+            /*
+                line:column of the current token, where diagnostics point
+            */
+            std::string location() const {
+                return tokens.location(curr_token);
             }
-            
+
+            /*
+                PANICs that the current token is not the `what` the parser wants. Out of line and cold, so the
+                checks in the parsing functions stay a compare and a branch
+            */
+            [[noreturn, gnu::noinline, gnu::cold]] void panic_expected(std::string_view what) const {
+                PANIC_AT(location(), "Expected " + std::string(what) + ", got " + tokens.describe(curr_token));
+            }
+
             void consume(int n){
-                prev_token = tokens[token_pointer];
+                prev_kind = curr_token.kind;
 
                 token_pointer += n;
-                        
+
                 if(token_pointer == num_tokens){
                     ERROR("Out of tokens! Token pointer: " + std::to_string(token_pointer) + " num_tokens: " + std::to_string(num_tokens));
                 } else {
@@ -31,9 +171,7 @@ namespace Assembler {
                 if(curr_token.kind == kind){
                     consume(1);
                 } else {
-                    std::cout << "Current token " << std::endl;
-                    std::cout << curr_token << std::endl;
-                    PANIC("Expected kind: " + std::to_string(kind) + " Current token not matched");
+                    panic_expected(token_kind_name(kind));
                 }
             }
 
@@ -45,560 +183,1509 @@ namespace Assembler {
                 }
             }
 
-            void set_labels(){
-
-                while(curr_token.kind != _EOF){
-
-                    std::cout << YELLOW(std::to_string(pc) + ": ") << curr_token << std::endl;
-
-                    if((curr_token.kind == LINE_END) && (prev_token.kind != LABEL_DEF)){
-                        pc += 1;
-
-                    } else if (curr_token.kind == LABEL_DEF) {
-                        // label definition, set in symbol table
-                        symbol_table[std::get<std::string>(curr_token.value)] = pc;
-                    }
+            void define_label(){
+                U32 id = curr_token.get_symbol_id();
 
-                    consume(1);
+                if(symbol_table[id] != UNDEFINED_LABEL){
+                    PANIC_AT(location(), "Label " + std::string(tokens.symbol_name(id)) + " is defined more than once");
                 }
+
+                symbol_table[id] = pc;
+                label_order.push_back(id);
             }
 
             void reset(){
                 pc = 0;
                 token_pointer = 0;
+                pseudo_expansions = 0;
+                relaxations = 0;
+                compressed = 0;
+                pooled = 0;
+                verify_seconds = 0;
+                parsed.clear();
+                parsed.reserve(PARSE_WINDOW);
+                code.clear();
+                fixups.clear();
+                fixup_tokens.clear();
+                encoded_fixups = 0;
+                addresses.clear();
+                relax_items.clear();
+                label_order.clear();
+                symbol_table.resize(tokens.num_symbols());
+                pools.clear();
+                pool_numbers.clear();
+                pool_data.clear();
+                open_pool_symbols.clear();
                 consume(0);
             }
 
-            void emit_binary(){
-                if(current_instr_binary){ 
-                    to_file(stream, current_instr_binary);
-                    current_instr_binary = 0UL;
+            /*
+                register number of the current token, which has to be a register
+            */
+            uint8_t consume_reg(){
+                if(!token_is_reg(curr_token.kind)){
+                    panic_expected("a register");
                 }
-            }
 
-            void set_register(Register_port port, U32 reg_num){
-                switch(port){
-                    case RD : current_instr_binary |= (reg_num << 7); break; 
-                    case RS1 : current_instr_binary |= (reg_num << 15); break; 
-                    case RS2 : current_instr_binary |= (reg_num << 20); break; 
-                }
-            }
-
-            void consume_reg(Register_port port){
-                U32 reg_num;
+                uint8_t reg_num = curr_token.get_reg_num();
 
-                assert(token_is_reg(curr_token.kind));
-                reg_num = std::get<U32>(curr_token.value);
+                consume(1);
 
-                set_register(port, reg_num);
+                return reg_num;
+            }
 
-                consume(1);
+            /*
+                record that the instruction at `pc` needs the address of `target` patched in
+            */
+            void add_fixup(Fixup_kind kind, U32 target, U64 base_index, bool literal = false){
+                fixups.push_back(Fixup{(uint32_t)pc, (uint32_t)base_index, target, kind, literal});
+                fixup_tokens.push_back(token_pointer);
             }
 
-            U64 get_imm(bool calc_pc_offset = false, bool prefer_label = false){
+            /*
+                Immediate of the current token. A label reference is recorded as a fixup of kind `fixup` and reads
+                as 0 until `resolve_fixups` patches it. With `calc_pc_offset` a literal is taken as the index of
+                an instruction in the output and turned into a byte offset from `pc`, once relaxation has decided
+                where `pc` ends up
+            */
+            U64 get_imm(Fixup_kind fixup, bool calc_pc_offset = false, bool prefer_label = false){
 
                 U64 addr = 0;
 
                 if((curr_token.kind == HEX || curr_token.kind == INT) && !prefer_label){
                     // address to jump to given, calculate offset directly
-                    const char* addr_str = std::get<std::string>(curr_token.value).c_str();
-                    char* endptr;
+                    addr = tokens.literal(curr_token.get_literal_id());
 
-                    addr = std::strtoul(addr_str, &endptr, 0);
-                
                 } else if (curr_token.kind == LABEL_DECL){
-                    addr = symbol_table[std::get<std::string>(curr_token.value) + ":"];
-                
+                    add_fixup(fixup, curr_token.get_symbol_id(), pc);
+                    return 0;
+
                 } else {
-                    std::cout << "Current token: " << std::endl << curr_token << std::endl;
-                    if(prefer_label){ 
-                        PANIC("Current token must be a label!");
+                    if(prefer_label){
+                        panic_expected("a label");
                     } else {
-                        PANIC("Only HEX, INT, LABEL_DECL can give imm!");
+                        panic_expected("a number or a label");
                     }
                 }
 
-                return (calc_pc_offset) ? (addr - pc) * 4 : addr;
+                if(calc_pc_offset){
+                    add_fixup(fixup, addr, pc, true);
+                    return 0;
+                }
+
+                return addr;
             }
 
-            int process_r_type_instr(const Instruction_data& instr_data){
-                
-                current_instr_binary |= instr_data.get_opcode();
-                place_bits(current_instr_binary, instr_data.get_funct3(), 12, 3);
-                place_bits(current_instr_binary, instr_data.get_funct7(), 25, 7);
+            /*
+                immediate of an I or S type instruction, a number has to fit in the signed 12 bits of the word
+            */
+            U64 get_imm_12(){
+                U64 imm = get_imm(FIXUP_ABS_LO12);
 
-                if(instr_data.from_pseudo_instr()){
-                    std::cout << "Adding R-type from pseudo instr" << std::endl;
+                if(!fits_in_signed_12_bits(imm)){
+                    PANIC_AT(location(), "Immediate " + std::to_string((int64_t)imm) + " does not fit in 12 bits, it has to be in -2048..2047");
+                }
 
-                    Pseudo_instruction_data pseudo_instr_data = instr_data.get_psi_data();
+                return imm;
+            }
 
-                    set_register(RD, pseudo_instr_data.rd);
-                    set_register(RS1, pseudo_instr_data.rs1);
-                    set_register(RS2, pseudo_instr_data.rs2);
-                
-                } else {
+            /*
+                Parsing of each format's operands, the mnemonic has already been consumed. Parsing only fills in
+                `operands`, `emit` encodes them
+            */
+            void parse_r_type(Operands& operands){
+                operands.rd = consume_reg();
+
+                consume(COMMA);
+
+                operands.rs1 = consume_reg();
+
+                consume(COMMA);
+
+                operands.rs2 = consume_reg();
+            }
+
+            void parse_i_type(Operands& operands){
+                // the mnemonic, just consumed
+                Token_kind kind = prev_kind;
+                U32 opcode = operands.base & 0x7f;
+                U32 funct3 = (operands.base >> 12) & 0x7;
+
+                operands.rd = consume_reg();
+
+                consume(COMMA);
+
+                if(opcode == 0b0000011){
+                    // loads, imm(rs1)
+                    operands.imm = get_imm_12();
 
                     consume(1);
 
-                    consume_reg(RD);
+                    consume(LBRACK);
 
-                    consume(COMMA);
+                    operands.rs1 = consume_reg();
+
+                    consume(RBRACK);
+
+                } else {
 
-                    consume_reg(RS1);
+                    operands.rs1 = consume_reg();
 
                     consume(COMMA);
 
-                    consume_reg(RS2);
-                } 
+                    // a shift amount is checked below, against its own width
+                    operands.imm = is_immediate_shift(opcode, funct3) ? get_imm(FIXUP_ABS_LO12) : get_imm_12();
 
-                return 1;
+                    consume(1);
+                }
+
+                if(is_immediate_shift(opcode, funct3)){
+                    // shift amount is 6 bits, 5 for most 32 bit shifts, funct7 stays in the upper bits of base
+                    U32 max_shamt = (1u << shamt_bits(kind)) - 1;
+
+                    if((U32)operands.imm > max_shamt){
+                        WARNING_AT(location(), "The shift amount is larger than " + std::to_string(max_shamt) + ", only its lower bits will be used");
+                    }
+
+                    operands.imm &= max_shamt;
+                }
             }
 
-            int process_i_type_instr(const Instruction_data& instr_data){
+            /*
+                rd and rs1, the immediate is fixed and already part of `base`
+            */
+            void parse_unary(Operands& operands){
+                operands.rd = consume_reg();
 
-                U32 opcode = instr_data.get_opcode();
-                U64 imm;
-                
-                current_instr_binary |= opcode;
-                place_bits(current_instr_binary, instr_data.get_funct3(), 12, 3);
+                consume(COMMA);
 
-                if(instr_data.from_pseudo_instr()){
-                    std::cout << "Adding I-type from pseudo instr" << std::endl;
+                operands.rs1 = consume_reg();
+            }
 
-                    Pseudo_instruction_data pseudo_instr_data = instr_data.get_psi_data();
+            void parse_s_type(Operands& operands){
+                operands.rs2 = consume_reg();
 
-                    set_register(RD, pseudo_instr_data.rd);
-                    imm = pseudo_instr_data.imm;
-                    set_register(RS1, pseudo_instr_data.rs1);
-                
-                } else {
+                consume(COMMA);
 
-                    consume(1);
+                operands.imm = get_imm_12();
 
-                    consume_reg(RD);
+                consume(1);
 
-                    consume(COMMA);
+                consume(LBRACK);
 
-                    if(opcode == 0b0000011){
-                        
-                        imm = get_imm();
+                operands.rs1 = consume_reg();
 
-                        consume(1);
+                consume(RBRACK);
+            }
 
-                        consume(LBRACK);
+            /*
+                registers only, the target is left to `emit_branch`
+            */
+            void parse_b_type(Operands& operands){
+                operands.rs1 = consume_reg();
 
-                        consume_reg(RS1);
+                consume(COMMA);
 
-                        consume(RBRACK);
-                        
-                    } else if (opcode == 0b0010011 || opcode == 0b1100111){
+                operands.rs2 = consume_reg();
 
-                        consume_reg(RS1);
-                        
-                        consume(COMMA);
-                        
-                        imm = get_imm(); 
+                consume(COMMA);
+            }
 
-                        consume(1);
-                    }
+            void parse_u_type(Operands& operands){
+                operands.rd = consume_reg();
 
-                }
+                consume(COMMA);
 
-                if(instr_data.get_funct3() == 1 || instr_data.get_funct3() == 5){
-                    // imm is unsigned 5 bit
-                    place_bits(current_instr_binary, get_bits(imm, 4, 0), 20, 12);
+                U64 imm = get_imm(FIXUP_ABS_HI20);
 
-                    if(imm > 4095){
-                        WARNING("The immediate passed for the shift instruction at " + std::to_string(pc) + " is more than 5 bits wide, only the least significant 5 bits will be considered");
-                    }
+                consume(1);
 
-                } else {
-                    place_bits(current_instr_binary, get_bits(imm, 11, 0), 20, 12);
+                if(!FITS_IN_20_BITS(imm)){
+                    PANIC_AT(location(), "The immediate does not fit in 20 bits");
                 }
 
-                return 1;
+                operands.imm = imm << 12;
             }
 
-            int process_s_type_instr(const Instruction_data& instr_data){
+            void parse_j_type(Operands& operands){
+                operands.rd = consume_reg();
+
+                consume(COMMA);
+
+                operands.imm = get_imm(FIXUP_J, true);
 
-                current_instr_binary |= instr_data.get_opcode();
-                place_bits(current_instr_binary, instr_data.get_funct3(), 12, 3);
                 consume(1);
+            }
 
-                consume_reg(RS2);
+            /*
+                vector register number of the current token, which has to be a vector register
+            */
+            uint8_t consume_vreg(){
+                if(curr_token.kind != VREG){
+                    panic_expected("a vector register");
+                }
 
-                consume(COMMA);
+                uint8_t reg_num = curr_token.get_vreg_num();
 
-                U64 imm = get_imm();
+                consume(1);
+
+                return reg_num;
+            }
+
+            /*
+                number of the current token, from `min` to `max`. Vector instructions take no labels
+            */
+            int32_t consume_literal(int64_t min, int64_t max){
+                if((curr_token.kind != INT) && (curr_token.kind != HEX)){
+                    panic_expected("an immediate");
+                }
+
+                int64_t imm = tokens.literal(curr_token.get_literal_id());
+
+                if((imm < min) || (imm > max)){
+                    PANIC_AT(location(), "Immediate " + std::to_string(imm) + " is not in " + std::to_string(min) + ".." + std::to_string(max));
+                }
 
-                place_bits(current_instr_binary, get_bits(imm, 4, 0), 7, 5);
-                place_bits(current_instr_binary, get_bits(imm, 11, 5), 25, 7);
                 consume(1);
 
+                return imm;
+            }
+
+            /*
+                the operand that goes where rs1 does: a vector register, a register or an imm5
+            */
+            uint8_t parse_vector_source(Vector_form form){
+                switch(form){
+                    case VFORM_VV:
+                    case VFORM_MACC_VV:
+                    case VFORM_VVM:
+                    case VFORM_MV_V: return consume_vreg();
+
+                    case VFORM_VI:
+                    case VFORM_VIM:
+                    case VFORM_MV_I: return consume_literal(-16, 15) & 0x1f;
+
+                    case VFORM_VI_UNSIGNED: return consume_literal(0, 31);
+
+                    case VFORM_VX:
+                    case VFORM_MACC_VX:
+                    case VFORM_VXM:
+                    case VFORM_MV_X:
+                    case VFORM_S_X:
+                    case VFORM_X_S:
+                    case VFORM_UNIT:
+                    case VFORM_STRIDED:
+                    case VFORM_INDEXED:
+                    case VFORM_SETVLI:
+                    case VFORM_SETIVLI:
+                    case VFORM_SETVL: return consume_reg();
+                }
+
+                return 0;
+            }
+
+            /*
+                `(rs1)` of a vector load or store, a 0 offset in front is allowed
+            */
+            uint8_t parse_vector_address(){
+                if((curr_token.kind == INT) || (curr_token.kind == HEX)){
+                    consume_literal(0, 0);
+                }
+
                 consume(LBRACK);
 
-                consume_reg(RS1);
-                
+                uint8_t rs1 = consume_reg();
+
                 consume(RBRACK);
 
-                return 1;
+                return rs1;
             }
 
-            int process_b_type_instr(const Instruction_data& instr_data){
-                
-                U64 imm;
+            /*
+                vtypei of vsetvli and vsetivli, a number of at most `bits` bits or words like `e32, m1, ta, ma`
+            */
+            U32 parse_vtype(int bits){
+                if((curr_token.kind == INT) || (curr_token.kind == HEX)){
+                    return consume_literal(0, (1 << bits) - 1);
+                }
 
-                current_instr_binary |= instr_data.get_opcode();
-                place_bits(current_instr_binary, instr_data.get_funct3(), 12, 3);
+                U32 vtype = 0;
+                U32 fields = 0;
 
-                if(instr_data.from_pseudo_instr()){
-                    Pseudo_instruction_data pseudo_instr_data = instr_data.get_psi_data();
-                    
-                    set_register(RS1, pseudo_instr_data.rs1);
-                    set_register(RS2, pseudo_instr_data.rs2);
-                    imm = pseudo_instr_data.imm;
-                
-                } else {
+                while(true){
+                    const Vtype_word* word = (curr_token.kind == LABEL_DECL) ? find_vtype_word(tokens.text(curr_token)) : nullptr;
+
+                    if(word == nullptr){
+                        panic_expected("a vtype word like e32, m1, ta or ma");
+                    }
+
+                    if((fields & word->field) || ((fields == 0) != (word->field == VTYPE_SEW))){
+                        PANIC_AT(location(), "The vtype has to start with the element width and can set every field once");
+                    }
+
+                    vtype |= word->bits;
+                    fields |= word->field;
 
                     consume(1);
 
-                    consume_reg(RS1);
-                    
+                    if(curr_token.kind != COMMA){
+                        return vtype;
+                    }
+
+                    consume(COMMA);
+                }
+            }
+
+            /*
+                Vector instructions, see vector.h. Masked instructions end in `, v0.t`, vmerge always takes v0
+            */
+            void parse_v_type(Vector_kind kind, Operands& operands){
+                Vector_form form = VECTOR_SPECS[kind].form;
+
+                switch(form){
+                    case VFORM_VV:
+                    case VFORM_VX:
+                    case VFORM_VI:
+                    case VFORM_VI_UNSIGNED:
+                    case VFORM_VVM:
+                    case VFORM_VXM:
+                    case VFORM_VIM:
+                        operands.rd = consume_vreg();
+                        consume(COMMA);
+                        operands.rs2 = consume_vreg();
+                        consume(COMMA);
+                        operands.rs1 = parse_vector_source(form);
+                        break;
+
+                    case VFORM_MACC_VV:
+                    case VFORM_MACC_VX:
+                        operands.rd = consume_vreg();
+                        consume(COMMA);
+                        operands.rs1 = parse_vector_source(form);
+                        consume(COMMA);
+                        operands.rs2 = consume_vreg();
+                        break;
+
+                    case VFORM_MV_V:
+                    case VFORM_MV_X:
+                    case VFORM_MV_I:
+                    case VFORM_S_X:
+                        operands.rd = consume_vreg();
+                        consume(COMMA);
+                        operands.rs1 = parse_vector_source(form);
+                        break;
+
+                    case VFORM_X_S:
+                        operands.rd = consume_reg();
+                        consume(COMMA);
+                        operands.rs2 = consume_vreg();
+                        break;
+
+                    case VFORM_UNIT:
+                    case VFORM_STRIDED:
+                    case VFORM_INDEXED:
+                        operands.rd = consume_vreg();
+                        consume(COMMA);
+                        operands.rs1 = parse_vector_address();
+
+                        if(form != VFORM_UNIT){
+                            consume(COMMA);
+                            operands.rs2 = (form == VFORM_STRIDED) ? consume_reg() : consume_vreg();
+                        }
+                        break;
+
+                    case VFORM_SETVLI:
+                    case VFORM_SETIVLI:
+                        operands.rd = consume_reg();
+                        consume(COMMA);
+                        operands.rs1 = (form == VFORM_SETVLI) ? consume_reg() : consume_literal(0, 31);
+                        consume(COMMA);
+                        operands.imm = parse_vtype((form == VFORM_SETVLI) ? 11 : 10);
+                        break;
+
+                    case VFORM_SETVL:
+                        operands.rd = consume_reg();
+                        consume(COMMA);
+                        operands.rs1 = consume_reg();
+                        consume(COMMA);
+                        operands.rs2 = consume_reg();
+                        break;
+                }
+
+                if((form == VFORM_VVM) || (form == VFORM_VXM) || (form == VFORM_VIM)){
                     consume(COMMA);
 
-                    consume_reg(RS2);
-                    
+                    if(consume_vreg() != 0){
+                        PANIC_AT(location(), "The mask of " + std::string(VECTOR_MNEMONICS[kind]) + " has to be v0");
+                    }
+
+                } else if (vector_form_is_maskable(form) && (curr_token.kind == COMMA)){
                     consume(COMMA);
+                    consume(V0_T);
 
-                    imm = get_imm(true, true);
+                    operands.base &= ~VM_BIT;
 
-                    consume(1);
+                    if((operands.rd == 0) && !vector_masked_vd_can_be_v0(kind)){
+                        PANIC_AT(location(), "The destination of " + std::string(VECTOR_MNEMONICS[kind]) + " is masked by v0 and can't be v0");
+                    }
                 }
+            }
 
-                place_bits(current_instr_binary, get_bits(imm, 11, 11), 7, 1);
-                place_bits(current_instr_binary, get_bits(imm, 4, 1), 8, 4);
-                place_bits(current_instr_binary, get_bits(imm, 10, 5), 25, 6);
-                place_bits(current_instr_binary, get_bits(imm, 12, 12), 31, 1);
+            void emit(const Operands& operands){
+                emit(operands, encode(operands));
+            }
 
-                return 1;
+            /*
+                `word` is `operands` encoded, by callers that know the format
+            */
+            void emit(const Operands& operands, U32 word){
+                assert(word == encode(operands));
+
+                code.push_back(word);
+                last_emitted = operands;
+                pc += 1;
+
+                if(compressing || verifying){
+                    parsed.push_back(operands);
+
+                    if(parsed.size() == PARSE_WINDOW){
+                        finish_parsed();
+                    }
+                }
+            }
+
+            /*
+                PANICs unless `word` at instruction `index` decodes to `operands`
+            */
+            void check_word(size_t index, U32 word, const Operands& operands) const {
+                bool half = is_compressed(word);
+                Decoded decoded = half ? expand(word) : decode(word);
+                Operands expected = canonical(half ? compress_alias(operands) : operands);
+
+                if(decoded.operands != expected){
+                    Decoded wanted = decode(expected.base);
+                    wanted.operands = expected;
+
+                    std::ostringstream text;
+                    text << HEX(word);
+
+                    PANIC("Verification failed at instruction " + std::to_string(index) + ": " + text.str() + " decodes to `" + to_string(decoded) + "`, expected `" + to_string(wanted) + "`");
+                }
             }
 
-            int process_u_type_instr(const Instruction_data& instr_data){
+            /*
+                `emit` encodes every word as it goes, with label operands still 0 for `resolve_fixups` to patch.
+                The records are only kept when compressing or verifying: the ones parsed since the last call,
+                which are the last words of `code`. When compressing, those without a label operand go out in
+                their 16 bit form right away, the rest wait for `lay_out_compressed`
+            */
+            void finish_parsed(){
+                const size_t n = parsed.size();
+                const size_t first = code.size() - n;
+
+                if(compressing){
+                    std::array<uint8_t, PARSE_WINDOW> patched {};
+
+                    for(; (encoded_fixups < fixups.size()) && (fixups[encoded_fixups].index < first + n); ++encoded_fixups){
+                        patched[fixups[encoded_fixups].index - first] = 1;
+                    }
 
-                U64 imm;
+                    for(size_t i = 0; i < n; ++i){
+                        U32 half = patched[i] ? 0 : compress(parsed[i]);
 
-                current_instr_binary |= instr_data.get_opcode();
+                        if(half){
+                            code[first + i] = half;
+                        }
+                    }
+                }
 
-                if(instr_data.from_pseudo_instr()){
+                if(verifying){
+                    Stopwatch verify_time;
 
-                    std::cout << "Adding LUI because of pseudo " << std::endl;
-                    
-                    Pseudo_instruction_data pseudo_instr_data = instr_data.get_psi_data(); 
+                    for(size_t i = 0; i < n; ++i){
+                        check_word(first + i, code[first + i], parsed[i]);
+                    }
 
-                    set_register(RD, pseudo_instr_data.rd);
+                    verify_seconds += verify_time.seconds();
+                }
 
-                    std::cout << "U type IMM: " << HEX(pseudo_instr_data.imm) << std::endl;
+                parsed.clear();
+            }
 
-                    imm = pseudo_instr_data.imm;
+            /*
+                label operand of the current token, the relax item it belongs to starts at `pc`
+            */
+            U32 add_relax_item(Relax_kind kind, Fixup_kind fixup){
+                if(curr_token.kind != LABEL_DECL){
+                    panic_expected("a label");
+                }
 
-                } else {
+                U32 symbol_id = curr_token.get_symbol_id();
 
-                    consume(1);
+                relax_items.push_back(Relax_item{(uint32_t)pc, (uint32_t)fixups.size(), kind});
+                add_fixup(fixup, symbol_id, pc);
 
-                    consume_reg(RD);
-                    
-                    consume(COMMA);
+                consume(1);
 
-                    imm = get_imm();
+                return symbol_id;
+            }
 
-                    consume(1);
+            /*
+                branch `operands` to the label of the current token
+            */
+            void emit_branch(const Operands& operands){
+                add_relax_item(RELAX_BRANCH, FIXUP_B);
+                emit(operands, encode<FORMAT_B>(operands));
+            }
 
-                    if(FITS_IN_20_BITS(imm)){
-                        place_bits(current_instr_binary, get_bits(imm, 19, 0), 12, 20);
-                        return 1;
+            /*
+                emit base instruction `kind` with the given operands
+            */
+            void emit(Token_kind kind, uint8_t rd, uint8_t rs1, uint8_t rs2, U64 imm){
+                Operands operands = operands_for(kind);
+                operands.rd = rd;
+                operands.rs1 = rs1;
+                operands.rs2 = rs2;
+                operands.imm = imm;
 
-                    } else {
-                        std::cout << "U_type imm " << pc << " : " << HEX(imm) << std::endl;
-                        PANIC("Imm does not fit in 20 bits!"); 
+                TRACE("Adding " << kind << " from pseudo instr, imm " << HEX(imm));
+
+                emit(operands);
+            }
+
+            /*
+                instruction `i` of the `li` expansion of `sequence` into `rd`
+            */
+            static Operands li_step(const Li_sequence& sequence, uint8_t i, uint8_t rd){
+                Token_kind kind = (Token_kind)sequence.steps[i].kind;
+                // every step but the first works on rd, sh*add adds it to itself and add.uw to zero
+                uint8_t rs = (i == 0) ? 0 : rd;
+                bool shadd = (kind == SH1ADD) || (kind == SH2ADD) || (kind == SH3ADD);
+
+                Operands operands = operands_for(kind);
+                operands.rd = rd;
+                operands.rs1 = rs;
+                operands.rs2 = shadd ? rs : 0;
+                operands.imm = sequence.steps[i].imm;
+
+                return operands;
+            }
+
+            /*
+                whether `li` of `value` loads it from a pool rather than building it with `sequence`
+            */
+            bool pool_pays_off(U64 value, const Li_sequence& sequence, uint8_t rd) const {
+                switch(pool_policy){
+                    case POOL_FOR_LATENCY: return sequence.size >= POOL_MIN_INSTRUCTIONS;
+
+                    case POOL_FOR_SIZE: {
+                        // auipc and ld, and the number unless the open pool has it already
+                        size_t pool_bytes = open_pool_symbols.count(value) ? 8 : 16;
+                        size_t li_bytes = 0;
+
+                        for(uint8_t i = 0; i < sequence.size; ++i){
+                            li_bytes += (compressing && compress(li_step(sequence, i, rd))) ? 2 : 4;
+                        }
+
+                        return pool_bytes < li_bytes;
                     }
                 }
 
-                place_bits(current_instr_binary, get_bits(imm, 31, 12), 12, 20);
+                return false;
+            }
 
-                return 1;
+            /*
+                symbol of `value` in the open pool, a new pool is opened if there is none or it is full
+            */
+            U32 pool_symbol(U64 value){
+                auto found = open_pool_symbols.find(value);
+
+                if(found != open_pool_symbols.end()){
+                    return found->second;
+                }
+
+                if(open_pool_symbols.size() == POOL_MAX_NUMBERS){
+                    close_pool();
+                }
+
+                if(open_pool_symbols.empty()){
+                    pool_opened_at = pc;
+                    pool_opened_relax_items = relax_items.size();
+                    pools.push_back(Literal_pool{(uint32_t)symbol_table.size(), (uint32_t)pool_numbers.size(), 0});
+                }
+
+                U32 symbol_id = symbol_table.size();
+
+                symbol_table.push_back(UNDEFINED_LABEL);
+                pool_numbers.push_back(value);
+                pools.back().size += 1;
+                open_pool_symbols.emplace(value, symbol_id);
+
+                return symbol_id;
             }
 
-            int process_j_type_instr(const Instruction_data& instr_data){
+            /*
+                Emits the open pool at `pc`, behind a jump over it if control could reach it from the instruction
+                before or through a label defined right here. The numbers go in as placeholder words and get
+                their place and value in `place_pools`, once relaxation and compression have moved everything
+            */
+            void close_pool(){
+                Literal_pool& pool = pools.back();
+                U32 end_symbol = pool.first_symbol + pool.size;
 
-                current_instr_binary |= instr_data.get_opcode();
+                symbol_table.push_back(UNDEFINED_LABEL);
 
-                consume(1);
-                
-                consume_reg(RD);
-                
-                consume(COMMA);
+                bool label_here = !label_order.empty() && (symbol_table[label_order.back()] == pc);
 
-                U64 imm = get_imm(true);
+                if((pc == 0) || !is_unconditional_jump(last_emitted) || label_here){
+                    add_fixup(FIXUP_J, end_symbol, pc);
+                    emit(JAL, 0, 0, 0, 0);
+                }
 
-                consume(1);
+                // the words of the pool are never parsed, they go after everything that was
+                finish_parsed();
+
+                // the pool labels are defined like any other, so `relax` moves them along
+                for(uint32_t k = 0; k < pool.size; ++k){
+                    symbol_table[pool.first_symbol + k] = pc + 2 * k;
+                    label_order.push_back(pool.first_symbol + k);
+                }
 
-                // imm[20|10:1|11|19:12]
-                place_bits(current_instr_binary, get_bits(imm, 19, 12), 12, 8);
-                place_bits(current_instr_binary, get_bits(imm, 11, 11), 20, 1);
-                place_bits(current_instr_binary, get_bits(imm, 10, 1), 21, 10);
-                place_bits(current_instr_binary, get_bits(imm, 20, 20), 31, 1);
+                code.resize(pc + 2 * pool.size, NOP_WORD);
+                code.resize(code.size() + pool_filler(), filler_word());
+                pc = code.size();
 
-                return 1;
+                symbol_table[end_symbol] = pc;
+                label_order.push_back(end_symbol);
+
+                open_pool_symbols.clear();
+            }
+
+            /*
+                filler words of each pool, enough to align the numbers whatever the pool's address
+            */
+            size_t pool_filler() const {
+                return compressing ? 3 : 1;
+            }
+
+            U32 filler_word() const {
+                return compressing ? C_NOP_WORD : NOP_WORD;
+            }
+
+            /*
+                At the end of every line. A per function pool closes after an unconditional jump, and any pool
+                before a load could lose sight of it: past POOL_REACH from the first load of the pool even if
+                every relax item from there on grows
+            */
+            void close_pool_if_due(){
+                U64 bound = (pc - pool_opened_at) + (relax_items.size() - pool_opened_relax_items) + 2 * pools.back().size + pool_filler() + 1;
+
+                if(((pool_placement == POOLS_PER_FUNCTION) && is_unconditional_jump(last_emitted)) || (bound * 4 > POOL_REACH)){
+                    close_pool();
+                }
             }
 
             int process_p_instr(){
                 /*
                     Pseudo instructions? I hardly know her
+
+                    How many instructions each one expands to is decided here, except for label operands
+                    that `relax` can grow, those are patched once the label is known
                 */
 
-                Pseudo_instruction_data pseudo_instr_data {0};
-                Instruction_data instr_data;
-                U64 imm;
                 Token instr_token = curr_token;
-                Token imm_token;
 
                 consume(1);
 
                 if((instr_token.kind == LI) | (instr_token.kind == LA)){
 
-                    pseudo_instr_data.rd = curr_token.get_reg_num();
-
-                    consume(1);
+                    uint8_t rd = consume_reg();
 
                     consume(COMMA);
 
-                    imm_token = curr_token;
-                    imm = get_imm();
-
-                    consume(1);
-
-                    if(imm > 4095){
+                    if(curr_token.kind == LABEL_DECL){
                         /*
-                            check whether we need to add 1 to upper instruction immediate for U-type instr
-                            if the 12th bit is set, we need to add 1 to the immediate
+                            address unknown until the end, la is pc relative and li absolute
                         */
-                        pseudo_instr_data.imm = imm + ((imm & 2048) != 0ULL);
+                        if(instr_token.kind == LI){
+                            add_relax_item(RELAX_LI, FIXUP_ABS_LO12);
+                            emit(ADDI, rd, 0, 0, 0);
 
-                        // rs1 of the U-type is rd in this instr
-                        pseudo_instr_data.rs1 = pseudo_instr_data.rd;
+                            return 1;
+                        }
 
-                        // emit U-type instr
-                        instr_data = find_instr_data_for((instr_token.kind == LA) && (imm_token.kind == LABEL_DECL) ? AUIPC : LUI);
-                        instr_data.set_pseudo_instr_data(pseudo_instr_data);
+                        U32 symbol_id = curr_token.get_symbol_id();
+                        U64 base_index = pc;
 
-                        process_u_type_instr(instr_data);
-                        emit_binary();
+                        consume(1);
 
-                        /*
-                            if lower 12 bits of imm are set, emit addi
-                        */
-                        if(imm & 2047){
-                            pseudo_instr_data.imm = imm; // set back to original in case of +1 for U-type
-                            instr_data = find_instr_data_for(ADDI);
-                            instr_data.set_pseudo_instr_data(pseudo_instr_data);
+                        add_fixup(FIXUP_PCREL_HI20, symbol_id, base_index);
+                        emit(AUIPC, rd, 0, 0, 0);
 
-                            process_i_type_instr(instr_data);
-                            emit_binary();
+                        add_fixup(FIXUP_PCREL_LO12_I, symbol_id, base_index);
+                        emit(ADDI, rd, rd, 0, 0);
 
-                            return 2;
-                        }
-    
-                    } else {
+                        return 2;
+                    }
 
-                        /*
-                            result fits in 12 bits
-                        */                    
-                        instr_data = find_instr_data_for(ADDI);
-                        instr_data.set_pseudo_instr_data(pseudo_instr_data);
+                    U64 imm = get_imm(FIXUP_ABS_LO12);
 
-                        process_i_type_instr(instr_data);
-                        emit_binary();
+                    consume(1);
+
+                    Li_sequence sequence = li_sequence(imm, bitmanip);
+
+                    if((pool_placement != POOLS_OFF) && (rd != 0) && pool_pays_off(imm, sequence, rd)){
+                        U32 symbol_id = pool_symbol(imm);
+                        U64 base_index = pc;
+
+                        add_fixup(FIXUP_PCREL_HI20, symbol_id, base_index);
+                        emit(AUIPC, rd, 0, 0, 0);
 
+                        add_fixup(FIXUP_PCREL_LO12_I, symbol_id, base_index);
+                        emit(LD, rd, rd, 0, 0);
+
+                        pooled += 1;
+
+                        return 2;
                     }
 
-                    return 1;
-                
-                } else if ((instr_token.kind == MV) || (instr_token.kind == NOT)){
+                    for(uint8_t i = 0; i < sequence.size; ++i){
+                        emit(li_step(sequence, i, rd));
+                    }
 
-                    pseudo_instr_data.rd = curr_token.get_reg_num();
+                    return sequence.size;
 
-                    consume(1);
+                } else if ((instr_token.kind == MV) || (instr_token.kind == NOT)){
 
-                    consume(COMMA);
+                    uint8_t rd = consume_reg();
 
-                    pseudo_instr_data.rs1 = curr_token.get_reg_num();
+                    consume(COMMA);
 
-                    consume(1);
+                    uint8_t rs = consume_reg();
 
                     if(instr_token.kind == MV){
-                        instr_data = find_instr_data_for(ADDI);
-
+                        emit(ADDI, rd, rs, 0, 0);
                     } else {
-                        instr_data = find_instr_data_for(XORI);
-                        pseudo_instr_data.imm = -1;
+                        emit(XORI, rd, rs, 0, -1);
                     }
 
-                    instr_data.set_pseudo_instr_data(pseudo_instr_data);
-                    
-                    process_i_type_instr(instr_data);
-                    emit_binary();
-                
                 } else if (instr_token.kind == NEG){
 
-                    pseudo_instr_data.rd = curr_token.get_reg_num();
-
-                    consume(1);
+                    uint8_t rd = consume_reg();
 
                     consume(COMMA);
 
-                    pseudo_instr_data.rs2 = curr_token.get_reg_num();
+                    uint8_t rs = consume_reg();
 
-                    consume(1);
+                    emit(SUB, rd, 0, rs, 0);
 
-                    instr_data = find_instr_data_for(SUB);
-                    instr_data.set_pseudo_instr_data(pseudo_instr_data);
-                    
-                    process_r_type_instr(instr_data);
-                    emit_binary();
-                
                 } else if ((instr_token.kind == BGT) || (instr_token.kind == BLE) || (instr_token.kind == BGTU) || (instr_token.kind == BLEU)){
-                    // TODO: fix these pseudos
+                    // same as the base branch with the operands swapped
+                    Operands operands = operands_for(PSEUDO_TO_BASE[instr_token.kind]);
 
-                    pseudo_instr_data.rs2 = curr_token.get_reg_num();
+                    operands.rs2 = consume_reg();
 
-                    consume(1);
+                    consume(COMMA);
+
+                    operands.rs1 = consume_reg();
 
                     consume(COMMA);
 
-                    pseudo_instr_data.rs1 = curr_token.get_reg_num();
+                    emit_branch(operands);
 
-                    consume(1);
+                } else if ((instr_token.kind == BEQZ) || (instr_token.kind == BNEZ) || (instr_token.kind == BGEZ) || (instr_token.kind == BLEZ) || (instr_token.kind == BGTZ)){
+                    // compare against x0, blez and bgtz have the register on the right hand side
+                    Operands operands = operands_for(PSEUDO_TO_BASE[instr_token.kind]);
+
+                    uint8_t reg_num = consume_reg();
 
                     consume(COMMA);
 
-                    pseudo_instr_data.imm = get_imm();
+                    if((instr_token.kind == BLEZ) || (instr_token.kind == BGTZ)){
+                        operands.rs2 = reg_num;
+                    } else {
+                        operands.rs1 = reg_num;
+                    }
+
+                    emit_branch(operands);
+
+                } else if (instr_token.kind == J){
+                    Operands operands = operands_for(JAL);
+                    operands.imm = get_imm(FIXUP_J, true);
 
                     consume(1);
 
-                    instr_data = find_instr_data_for(pseudo_to_base[instr_token.kind]);
-                    instr_data.set_pseudo_instr_data(pseudo_instr_data);
+                    emit(operands);
+
+                } else if (instr_token.kind == CALL){
+                    add_relax_item(RELAX_CALL, FIXUP_J);
+                    emit(JAL, 1, 0, 0, 0);
 
-                    process_b_type_instr(instr_data);
-                    emit_binary();
+                } else if (instr_token.kind == RET){
+                    emit(JALR, 0, 1, 0, 0);
+
+                } else if (instr_token.kind == NOP){
+                    emit(ADDI, 0, 0, 0, 0);
+
+                } else {
+                    PANIC_AT(tokens.location(instr_token), "Pseudo instruction " + tokens.describe(instr_token) + " is not supported yet");
                 }
 
                 return 1;
             }
 
+            /*
+                one handler per kind of statement, `process` picks it out of `DISPATCH` by token kind
+            */
+            void process_label_def(){
+                define_label();
+                consume(1);
+            }
+
+            void process_line_end(){
+                consume(1);
+
+                if(!open_pool_symbols.empty()){
+                    close_pool_if_due();
+                }
+            }
+
+            /*
+                a base instruction, `parse` reads the operands of its format
+            */
+            template<Instr_format F, void (Assembler::*parse)(Operands&)>
+            void process_base_instr(){
+                Operands operands = operands_for(curr_token.kind);
+
+                consume(1);
+
+                (this->*parse)(operands);
+                emit(operands, encode<F>(operands));
+            }
+
+            void process_vector_instr(){
+                Vector_kind kind = curr_token.get_vector_kind();
+                Operands operands = vector_operands_for(kind);
+
+                consume(1);
+
+                parse_v_type(kind, operands);
+                emit(operands);
+            }
+
+            void process_branch(){
+                Operands operands = operands_for(curr_token.kind);
+
+                consume(1);
+
+                parse_b_type(operands);
+                emit_branch(operands);
+            }
+
+            void process_pseudo(){
+                // emits its own instructions
+                process_p_instr();
+                pseudo_expansions += 1;
+            }
+
+            void process_unhandled(){
+                WARNING_AT(location(), "Unexpected " + tokens.describe(curr_token) + ", skipped");
+
+                consume(1);
+            }
+
             void process(){
+                while(curr_token.kind != _EOF){
+                    (this->*DISPATCH[curr_token.kind])();
+                }
 
-                if(curr_token.kind == _EOF){
-                    return;
+                if(!open_pool_symbols.empty()){
+                    close_pool();
                 }
 
-                if(curr_token.kind == LABEL_DEF){
-                    // handled in `set_labels`
-                    consume(1);
+                finish_parsed();
+            }
+
+            /*
+                encoded word `word` with `imm` in the immediate of fixup kind `kind`, whose bits are still 0
+            */
+            static U32 place_imm(U32 word, Fixup_kind kind, U32 imm){
+                switch(kind){
+                    case FIXUP_B: return word | encode_imm<FORMAT_B>(imm);
+                    case FIXUP_J: return word | encode_imm<FORMAT_J>(imm);
+                    case FIXUP_PCREL_HI20:
+                    case FIXUP_ABS_HI20: return word | encode_imm<FORMAT_U>(imm);
+                    case FIXUP_PCREL_LO12_I: return word | encode_imm<FORMAT_I>(imm);
+                    // the stores are the only S format instructions with a label operand
+                    case FIXUP_ABS_LO12: return word | (((word & 0x7f) == 0b0100011) ? encode_imm<FORMAT_S>(imm) : encode_imm<FORMAT_I>(imm));
+                }
+
+                return word;
+            }
+
+            /*
+                patch every label reference now that all labels are known
+            */
+            void resolve_fixups(){
 
-                } else if(curr_token.kind == LINE_END){ 
+                for(size_t f = 0; f < fixups.size(); ++f){
+                    const Fixup& fixup = fixups[f];
+                    U64 label = fixup.literal ? fixup.target : symbol_table[fixup.target];
 
-                    if(prev_token.kind != LABEL_DEF){
-                        emit_binary();      
+                    if(label == UNDEFINED_LABEL){
+                        PANIC_AT(tokens.location(tokens[fixup_tokens[f]]), "Label " + std::string(tokens.symbol_name(fixup.target)) + " is used but never defined");
                     }
 
-                    consume(1);
-                
-                } else if(token_kind_is_between(curr_token.kind, R_TYPE_START, R_TYPE_END)){ 
-                    pc += process_r_type_instr(curr_token.get_instr_data());
-                
-                } else if (token_kind_is_between(curr_token.kind, I_TYPE_START, I_TYPE_END)){
-                    pc += process_i_type_instr(curr_token.get_instr_data());
+                    U64 addr = address_of(label);
+                    U64 offset = addr - address_of(fixup.base_index);
+                    U32& word = code[fixup.index];
+                    int32_t imm = 0;
 
-                } else if (token_kind_is_between(curr_token.kind, S_TYPE_START, S_TYPE_END)){
-                    pc += process_s_type_instr(curr_token.get_instr_data());
+                    if(((fixup.kind == FIXUP_B) && !fits_branch_offset(offset)) || ((fixup.kind == FIXUP_J) && !fits_jump_offset(offset))){
+                        PANIC_AT(tokens.location(tokens[fixup_tokens[f]]), "The target is " + std::to_string((int64_t)offset) + " bytes away, out of range");
+                    }
 
-                } else if (token_kind_is_between(curr_token.kind, B_TYPE_START, B_TYPE_END)){
-                    pc += process_b_type_instr(curr_token.get_instr_data());
+                    switch(fixup.kind){
+                        case FIXUP_B:
+                        case FIXUP_J:
+                        case FIXUP_PCREL_LO12_I: imm = offset; break;
+                        case FIXUP_PCREL_HI20: imm = hi20(offset); break;
+                        case FIXUP_ABS_HI20: imm = hi20(addr); break;
+                        case FIXUP_ABS_LO12: imm = addr; break;
+                    }
 
-                } else if (token_kind_is_between(curr_token.kind, U_TYPE_START, U_TYPE_END)){
-                    pc += process_u_type_instr(curr_token.get_instr_data());
+                    U32 patched = place_imm(word, fixup.kind, imm);
 
-                } else if(curr_token.kind == JAL){
-                    pc += process_j_type_instr(curr_token.get_instr_data());
-                    
-                } else if (token_is_pseudo_instr(curr_token.kind)){
+                    if(verifying){
+                        Operands operands = decode(word).operands;
+                        operands.imm = imm;
 
-                    int num_added_instrs = process_p_instr();
+                        check_word(fixup.index, patched, operands);
+                    }
 
-                    if(num_added_instrs > 1){
-                        // go through all labels below this pseudo instruction and change the address they point to 
-                        for(auto& [label, label_addr] : symbol_table){
-                            if(label_addr > pc){label_addr += num_added_instrs - 1;}
-                        }
+                    word = patched;
+                }
+            }
+
+            /*
+                whether `item` at instruction `index` reaches the label at instruction `label` in its short form,
+                with every instruction in front of the label taking `stretch` instructions
+            */
+            static bool fits_short_form(const Relax_item& item, int64_t index, int64_t label, int64_t stretch = 1){
+                int64_t addr = label * 4 * stretch;
+                int64_t offset = (label - index) * 4 * stretch;
+
+                switch(item.kind){
+                    case RELAX_BRANCH: return fits_branch_offset(offset);
+                    case RELAX_CALL: return fits_jump_offset(offset);
+                    case RELAX_LI: return fits_in_signed_12_bits(addr);
+                }
+
+                return true;
+            }
+
+            /*
+                Decides which relax items need their long form. Every item starts out short and grows once its
+                label is out of reach, round after round until none grows. Growing never moves two instructions
+                closer together, so nothing that grew would fit again. An item that would still fit if every
+                instruction up to its label grew is settled in the first round, only the few others are looked
+                at again. When nothing grows, which is the common case, relaxing is one pass over the items.
+                Otherwise the code grows in place once at the end
+            */
+            void relax(){
+                const size_t n_items = relax_items.size();
+
+                // the grown items, in program order
+                std::vector<uint32_t> grown;
+                // items that fit, but might not once others grow
+                std::vector<uint32_t> at_risk;
+
+                for(uint32_t k = 0; k < n_items; ++k){
+                    Relax_item& item = relax_items[k];
+                    U64 label = symbol_table[fixups[item.fixup].target];
+
+                    // left for `resolve_fixups` to report
+                    if(label == UNDEFINED_LABEL){
+                        continue;
                     }
 
-                    pc += num_added_instrs;
+                    if(!fits_short_form(item, item.index, label)){
+                        item.grown = true;
+                        grown.push_back(k);
+                    } else if (!fits_short_form(item, item.index, label, 2)){
+                        at_risk.push_back(k);
+                    }
+                }
 
-                } else {
-                    WARNING("Unhandled token " + std::to_string(curr_token.kind));
+                relaxations = n_items - grown.size();
 
-                    consume(1);
+                if(grown.empty()){
+                    return;
                 }
 
-                process();
-            }
+                /*
+                    where instruction `index` ends up, one further down for every grown item in front of it.
+                    Queries close to the previous one are cheapest since the cursor only walks from where it
+                    was left
+                */
+                size_t cursor = 0;
+
+                auto final_index = [&](U64 index){
+                    while((cursor < grown.size()) && (relax_items[grown[cursor]].index < index)) ++cursor;
+                    while((cursor > 0) && (relax_items[grown[cursor - 1]].index >= index)) --cursor;
+
+                    return index + cursor;
+                };
+
+                for(size_t newly_grown = grown.size(); newly_grown > 0;){
+                    size_t grown_before = grown.size();
+                    size_t still_at_risk = 0;
+
+                    for(uint32_t k : at_risk){
+                        Relax_item& item = relax_items[k];
+                        U64 label = final_index(symbol_table[fixups[item.fixup].target]);
+
+                        if(!fits_short_form(item, final_index(item.index), label)){
+                            item.grown = true;
+                            grown.push_back(k);
+                        } else {
+                            at_risk[still_at_risk++] = k;
+                        }
+                    }
+
+                    at_risk.resize(still_at_risk);
+                    newly_grown = grown.size() - grown_before;
+
+                    // the layout of the next round, the ones grown in this round are only counted from there on
+                    std::inplace_merge(grown.begin(), grown.begin() + grown_before, grown.end());
+                    cursor = 0;
+                }
+
+                relaxations = n_items - grown.size();
 
-            void run(){
                 /*
-                    do first pass to sort out labels
+                    the long form takes the place of the short one, followed by its second instruction. The
+                    words are rewritten where they are, then everything behind each item moves down in one pass
+                    from the back
                 */
-                reset(); set_labels();
+                std::vector<U32> second(grown.size());
+
+                for(size_t g = 0; g < grown.size(); ++g){
+                    const Relax_item& item = relax_items[grown[g]];
+                    // the short form has a label operand, so it is still a 32 bit word
+                    U32& first = code[item.index];
+                    uint8_t rd = (first >> 7) & 0x1f;
+
+                    switch(item.kind){
+                        case RELAX_BRANCH:
+                            // funct3 bit 0 tells beq/bne, blt/bge and bltu/bgeu apart, the inverted branch
+                            // skips the jal, however long that ends up
+                            first ^= 1 << 12;
+                            second[g] = encode(operands_for(JAL));
+                            break;
+
+                        case RELAX_CALL:
+                            first = encode(Operands{operands_for(AUIPC).base, 0, 1, 0, 0, FORMAT_U});
+                            second[g] = encode(Operands{operands_for(JALR).base, 0, 1, 1, 0, FORMAT_I});
+                            break;
+
+                        case RELAX_LI:
+                            first = encode(Operands{operands_for(LUI).base, 0, rd, 0, 0, FORMAT_U});
+                            second[g] = encode(Operands{operands_for(ADDI).base, 0, rd, rd, 0, FORMAT_I});
+                            break;
+                    }
+                }
+
+                size_t end = code.size();
+                code.resize(end + grown.size());
+
+                for(size_t g = grown.size(); g > 0; --g){
+                    size_t behind = relax_items[grown[g - 1]].index + 1;
+
+                    std::move_backward(code.begin() + behind, code.begin() + end, code.begin() + end + g);
+                    code[behind + g - 1] = second[g - 1];
+
+                    end = behind;
+                }
+
+                pc = code.size();
+
+                // most fixups measure from their own instruction
+                for(Fixup& fixup : fixups){
+                    U32 index = fixup.index;
+
+                    fixup.index = final_index(index);
+                    fixup.base_index = (fixup.base_index == index) ? fixup.index : final_index(fixup.base_index);
+                }
+
+                for(U32 id : label_order){
+                    symbol_table[id] = final_index(symbol_table[id]);
+                }
+
+                // the fixup of the short form moves to the instruction holding the label offset
+                fixups.reserve(fixups.size() + grown.size());
+                fixup_tokens.reserve(fixups.capacity());
+
+                for(uint32_t k : grown){
+                    const Relax_item& item = relax_items[k];
+                    Fixup& fixup = fixups[item.fixup];
+                    uint32_t at = fixup.index;
+
+                    fixup_tokens.push_back(fixup_tokens[item.fixup]);
+
+                    switch(item.kind){
+                        case RELAX_BRANCH:
+                            fixup = Fixup{at + 1, at + 1, fixup.target, FIXUP_J, fixup.literal};
+                            fixups.push_back(Fixup{at, at, at + 2, FIXUP_B, true});
+                            break;
+
+                        case RELAX_CALL:
+                            fixup.kind = FIXUP_PCREL_HI20;
+                            fixups.push_back(Fixup{at + 1, at, fixup.target, FIXUP_PCREL_LO12_I});
+                            break;
+
+                        case RELAX_LI:
+                            fixup.kind = FIXUP_ABS_HI20;
+                            fixups.push_back(Fixup{at + 1, at, fixup.target, FIXUP_ABS_LO12});
+                            break;
+                    }
+                }
+            }
+
+            /*
+                byte address of instruction `index`, indices past the end continue in 4 byte steps
+            */
+            U64 address_of(U64 index) const {
+                if(addresses.empty()){
+                    return index * 4;
+                }
+
+                size_t end = addresses.size() - 1;
+
+                return (index <= end) ? addresses[index] : addresses[end] + (index - end) * 4;
+            }
+
+            /*
+                Picks the instructions that go out in 16 bits and gives every instruction its byte address.
+                Instructions without a label operand were decided by `finish_parsed`. Branches and jumps to
+                labels start out at 4 bytes and are shortened once their target is in reach of the 16 bit form,
+                round after round like in `relax`, and for the same reason that ends
+            */
+            void lay_out_compressed(){
+                const size_t n = code.size();
+
+                std::vector<uint8_t> size(n);
+
+                for(size_t i = 0; i < n; ++i){
+                    size[i] = is_compressed(code[i]) ? 2 : 4;
+                }
+
+                // fixups of branches and jumps that have a 16 bit form if their target is close enough
+                std::vector<uint32_t> pending;
+
+                for(uint32_t f = 0; f < fixups.size(); ++f){
+                    const Fixup& fixup = fixups[f];
+
+                    if(((fixup.kind == FIXUP_B) || (fixup.kind == FIXUP_J)) && compressible_with_offset(decode(code[fixup.index]).operands)){
+                        pending.push_back(f);
+                    }
+                }
+
+                addresses.resize(n + 1);
+
+                for(bool changed = true; changed;){
+                    changed = false;
+
+                    U32 address = 0;
+
+                    for(size_t i = 0; i < n; ++i){
+                        addresses[i] = address;
+                        address += size[i];
+                    }
+
+                    addresses[n] = address;
+
+                    size_t still_pending = 0;
+
+                    for(uint32_t f : pending){
+                        const Fixup& fixup = fixups[f];
+                        U64 label = fixup.literal ? fixup.target : symbol_table[fixup.target];
+
+                        // left for `resolve_fixups` to report
+                        if(label == UNDEFINED_LABEL){
+                            continue;
+                        }
+
+                        int64_t offset = (int64_t)address_of(label) - (int64_t)addresses[fixup.index];
+                        bool fits = (fixup.kind == FIXUP_B) ? fits_c_branch_offset(offset) : fits_c_jump_offset(offset);
+
+                        if(fits){
+                            size[fixup.index] = 2;
+                            changed = true;
+                        } else {
+                            pending[still_pending++] = f;
+                        }
+                    }
 
-                std::cout << "Symbol table " << std::endl;
-                for(const auto& [k, v] : symbol_table){
-                    std::cout << k << " " << v << std::endl;
+                    pending.resize(still_pending);
                 }
-                std::cout << std::endl;
+
+                compressed = std::count(size.begin(), size.end(), 2);
+            }
+
+            /*
+                Moves as much filler in front of the numbers of each pool as aligns them to 8 bytes, and fills
+                in the numbers, half a number per word. The pool keeps its size, so nothing else moves
+            */
+            void place_pools(){
+                for(const Literal_pool& pool : pools){
+                    U64 start = symbol_table[pool.first_symbol];
+                    U64 end = start + 2 * pool.size + pool_filler();
+                    U64 address = address_of(start);
+                    // in 4 or, when compressing, 2 byte filler
+                    U64 filler_before = compressing ? ((-address & 7) >> 1) : ((address & 7) != 0);
+                    U64 numbers = start + filler_before;
+
+                    std::fill(code.begin() + start, code.begin() + end, filler_word());
+
+                    for(uint32_t k = 0; k < pool.size; ++k){
+                        U64 value = pool_numbers[pool.first_number + k];
+
+                        symbol_table[pool.first_symbol + k] = numbers + 2 * k;
+
+                        code[numbers + 2 * k] = value;
+                        code[numbers + 2 * k + 1] = value >> 32;
+                    }
+
+                    pool_data.push_back(Data_range{(U32)numbers, (U32)(numbers + 2 * pool.size)});
+
+                    if(compressing){
+                        for(U64 i = start; i < end; ++i){
+                            bool data = (i >= numbers) && (i < numbers + 2 * pool.size);
+
+                            addresses[i + 1] = addresses[i] + (data ? 4 : 2);
+                        }
+                    }
+                }
+            }
+
+            void run(const Assemble_options& options = {}){
+                compressing = options.compress;
+                bitmanip = options.bitmanip;
+                pool_placement = options.pools;
+                pool_policy = options.pool_policy;
+                verifying = options.verify;
 
                 /*
-                    second pass for assembly
+                    single pass over the tokens that encodes as it goes, then the code is relaxed and label
+                    references are patched into the words
                 */
+                Stopwatch assemble_time;
                 reset(); process();
+                assemble_seconds = assemble_time.seconds();
+
+                Stopwatch fixup_time;
+                relax();
+
+                if(compressing){
+                    lay_out_compressed();
+                }
+
+                place_pools();
+                resolve_fixups();
+
+                if(compressing){
+                    // the branches and jumps `lay_out_compressed` shortened
+                    for(const Fixup& fixup : fixups){
+                        size_t i = fixup.index;
+
+                        if((addresses[i + 1] - addresses[i] == 2) && !is_compressed(code[i])){
+                            Operands operands = decode(code[i]).operands;
+
+                            code[i] = compress(operands);
+
+                            if(verifying){
+                                check_word(i, code[i], operands);
+                            }
+                        }
+                    }
+                }
+
+                fixup_seconds = fixup_time.seconds();
+
+                if(log_enabled(LOG_DEBUG)){
+                    DEBUG("Symbol table");
+                    for(uint32_t id = 0; id < tokens.num_symbols(); ++id){
+                        if(symbol_table[id] != UNDEFINED_LABEL){
+                            DEBUG(tokens.symbol_name(id) << " " << symbol_table[id]);
+                        }
+                    }
+                    DEBUG("");
+                }
+            }
+
+            const std::vector<U32>& get_code() const { return code; }
+
+            std::vector<U32> take_code() { return std::move(code); }
+
+            const std::vector<Data_range>& get_data() const { return pool_data; }
+
+            /*
+                every defined label of the source with its byte address, in symbol id order
+            */
+            std::vector<Symbol> get_symbols() const {
+                std::vector<Symbol> symbols;
+
+                for(uint32_t id = 0; id < tokens.num_symbols(); ++id){
+                    if(symbol_table[id] != UNDEFINED_LABEL){
+                        symbols.push_back(Symbol{std::string(tokens.symbol_name(id)), address_of(symbol_table[id])});
+                    }
+                }
+
+                return symbols;
+            }
+
+            /*
+                write the code image next to the output path, with the writer's extension
+            */
+            size_t write(const Code_writer& writer) const {
+                fs::path path = output_path;
+                return writer.write_file(code, pool_data, get_symbols(), path.replace_extension(writer.extension()));
+            }
+
+            /*
+                counters and phase times of the last `run`
+            */
+            void collect_stats(File_stats& stats) const {
+                stats.assemble_seconds = assemble_seconds;
+                stats.fixup_seconds = fixup_seconds;
+                stats.verify_seconds = verify_seconds;
+                stats.tokens = num_tokens;
+                stats.instructions = code.size();
+                stats.pseudo_expansions = pseudo_expansions;
+                stats.symbols = std::count_if(symbol_table.begin(), symbol_table.begin() + tokens.num_symbols(), [](U64 label){ return label != UNDEFINED_LABEL; });
+                stats.fixups = fixups.size();
+                stats.relaxations = relaxations;
+                stats.compressed = compressed;
+                stats.pooled = pooled;
             }
 
         private:
-            std::ofstream stream;
-            
+            static constexpr U64 UNDEFINED_LABEL = ~0ULL;
+            // a pool is small enough for the jump over it
+            static constexpr size_t POOL_MAX_NUMBERS = 4096;
+            // of auipc and a 12 bit offset, the bytes from auipc to the end of its pool
+            static constexpr U64 POOL_REACH = (1ULL << 31) - 2048;
+            // records kept for compressing and verifying, few enough to stay in L1
+            static constexpr size_t PARSE_WINDOW = 1024;
+            static constexpr U32 NOP_WORD = encode(operands_for(ADDI));
+            static constexpr U32 C_NOP_WORD = compress(operands_for(ADDI));
+
+            using Handler = void (Assembler::*)();
+
+            static constexpr std::array<Handler, NUM_TOKEN_KINDS> make_dispatch_table(){
+                std::array<Handler, NUM_TOKEN_KINDS> table {};
+
+                auto fill = [&](Token_kind kind_start, Token_kind kind_end, Handler handler){
+                    for(int kind = kind_start + 1; kind < kind_end; ++kind) table[kind] = handler;
+                };
+
+                table.fill(&Assembler::process_unhandled);
+
+                fill(R_TYPE_START, R_TYPE_END, &Assembler::process_base_instr<FORMAT_R, &Assembler::parse_r_type>);
+                fill(I_TYPE_START, I_TYPE_END, &Assembler::process_base_instr<FORMAT_I, &Assembler::parse_i_type>);
+                fill(S_TYPE_START, S_TYPE_END, &Assembler::process_base_instr<FORMAT_S, &Assembler::parse_s_type>);
+                fill(B_TYPE_START, B_TYPE_END, &Assembler::process_branch);
+                fill(U_TYPE_START, U_TYPE_END, &Assembler::process_base_instr<FORMAT_U, &Assembler::parse_u_type>);
+                fill(J_TYPE_START, J_TYPE_END, &Assembler::process_base_instr<FORMAT_J, &Assembler::parse_j_type>);
+                fill(UNARY_START, UNARY_END, &Assembler::process_base_instr<FORMAT_I, &Assembler::parse_unary>);
+                fill(PSEUDO_INSTR_START, PSEUDO_INSTR_END, &Assembler::process_pseudo);
+
+                table[V_INSTR] = &Assembler::process_vector_instr;
+                table[LABEL_DEF] = &Assembler::process_label_def;
+                table[LINE_END] = &Assembler::process_line_end;
+
+                return table;
+            }
+
+            static const std::array<Handler, NUM_TOKEN_KINDS> DISPATCH;
+
+            fs::path output_path;
+
             unsigned int num_tokens = 0;
             unsigned int token_pointer = 0;
             Token curr_token;
             Token next_token;
-            Token prev_token;
-
-            std::vector<Token> tokens;
-
-            // symbol table and equ directive table
-            std::unordered_map<std::string, U64> symbol_table = {};
+            Token_kind prev_kind = _EOF;
+
+            Token_stream tokens;
+
+            // instruction index of every label, indexed by symbol id, the pool symbols after those of the source
+            std::vector<U64> symbol_table;
+            // ids of the defined labels, in program order
+            std::vector<U32> label_order;
+
+            // instructions parsed since the last `finish_parsed`
+            std::vector<Operands> parsed;
+            Operands last_emitted;
+            // one word per instruction, 16 bit instructions in the lower half
+            std::vector<U32> code;
+            std::vector<Fixup> fixups;
+            // token each fixup comes from, where the errors of `resolve_fixups` point
+            std::vector<uint32_t> fixup_tokens;
+            // fixups of instructions `finish_parsed` has seen
+            size_t encoded_fixups = 0;
+            // byte address of every instruction and of the end, only kept when compressing
+            std::vector<U32> addresses;
+            // in program order
+            std::vector<Relax_item> relax_items;
+
+            std::vector<Literal_pool> pools;
+            // of every pool, in pool order
+            std::vector<U64> pool_numbers;
+            // words holding the numbers, filled in by `place_pools`
+            std::vector<Data_range> pool_data;
+            // symbol of each number in the open pool, empty while no pool is open
+            std::unordered_map<U64, U32> open_pool_symbols;
+            // `pc` and the number of relax items when the open pool got its first number
+            U64 pool_opened_at = 0;
+            size_t pool_opened_relax_items = 0;
 
             U64 pc = 0ULL;
-            U32 current_instr_binary = 0UL;
-
-            std::unordered_map<Token_kind, Token_kind> pseudo_to_base = {
-                {BGT, BLT},
-                {BLE, BGE},
-                {BGTU, BLTU},
-                {BLEU, BGEU},
-                {BEQZ, BEQ},
-                {BNEZ, BNE},
-                {BGEZ, BGE},
-                {BLEZ, BGE},
-                {BGTZ, BLT},
-            };
+            bool compressing = false;
+            bool verifying = false;
+            // `Bitmanip_extension`s of the `li` expansion
+            uint8_t bitmanip = 0;
+            Pool_placement pool_placement = POOLS_OFF;
+            Pool_policy pool_policy = POOL_FOR_LATENCY;
+
+            size_t pseudo_expansions = 0;
+            size_t relaxations = 0;
+            size_t compressed = 0;
+            size_t pooled = 0;
+            double assemble_seconds = 0;
+            double fixup_seconds = 0;
+            // of the words as they are encoded, the patched ones are checked as part of the fixups
+            double verify_seconds = 0;
+
+            // base instruction each branch pseudo instruction turns into
+            static constexpr std::array<Token_kind, NUM_TOKEN_KINDS> PSEUDO_TO_BASE = []{
+                std::array<Token_kind, NUM_TOKEN_KINDS> table {};
+
+                table[BGT] = BLT;
+                table[BLE] = BGE;
+                table[BGTU] = BLTU;
+                table[BLEU] = BGEU;
+                table[BEQZ] = BEQ;
+                table[BNEZ] = BNE;
+                table[BGEZ] = BGE;
+                table[BLEZ] = BGE;
+                table[BGTZ] = BLT;
+
+                return table;
+            }();
     };
 
-}
\ No newline at end of file
+    inline constexpr std::array<Assembler::Handler, NUM_TOKEN_KINDS> Assembler::DISPATCH = Assembler::make_dispatch_table();
+
+}
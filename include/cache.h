@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include "utils.h"
+
+#ifndef ASSEMBLER_VERSION
+#define ASSEMBLER_VERSION "0.2.0"
+#endif
+
+namespace Assembler {
+
+    /*
+        changes whenever the assembler is rebuilt, so cached outputs never outlive the code that made them
+    */
+    inline constexpr const char* ASSEMBLER_BUILD_ID = ASSEMBLER_VERSION " " __DATE__ " " __TIME__;
+
+    /*
+        64 bit hash of arbitrary bytes, 8 bytes per step. Two seeds give the 128 bit cache key
+    */
+    inline U64 content_hash(std::string_view data, U64 seed){
+        constexpr U64 K1 = 0x9e3779b97f4a7c15ULL;
+        constexpr U64 K2 = 0xc2b2ae3d27d4eb4fULL;
+
+        auto mix = [](U64 h){
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 33;
+            return h;
+        };
+
+        U64 h = seed ^ (data.size() * K1);
+        const char* p = data.data();
+        const char* end = p + (data.size() & ~(size_t)7);
+
+        for(; p < end; p += 8){
+            U64 word;
+            std::memcpy(&word, p, 8);
+
+            h ^= mix(word * K2);
+            h = ((h << 27) | (h >> 37)) * K1;
+        }
+
+        U64 tail = 0;
+        std::memcpy(&tail, p, data.size() & 7);
+        h ^= mix(tail * K2 + (data.size() & 7));
+
+        return mix(h);
+    }
+
+    /*
+        Outputs keyed by a hash of the source, the assembler build and every option that changes the output.
+        Entries are never written in place, they are created under a temporary name and renamed, so any
+        number of jobs or runs can share one cache directory
+    */
+    class Build_cache {
+
+        public:
+            explicit Build_cache(fs::path _dir) :
+                dir(std::move(_dir))
+            {
+                fs::create_directories(dir);
+            }
+
+            /*
+                `options` is every option that affects the output, the extension keeps formats apart
+            */
+            std::string key(std::string_view source, std::string_view options) const {
+                std::string salt = std::string(ASSEMBLER_BUILD_ID) + '\0' + std::string(options);
+
+                U64 parts[4] = {
+                    content_hash(source, 1),
+                    content_hash(source, 2),
+                    content_hash(salt, 1),
+                    content_hash(salt, 2),
+                };
+
+                char hex[33];
+                std::snprintf(hex, sizeof(hex), "%016llx%016llx", (unsigned long long)(parts[0] ^ parts[2]), (unsigned long long)(parts[1] ^ parts[3]));
+
+                return hex;
+            }
+
+            /*
+                put the cached output for `key` at `output`, returns false on a miss
+            */
+            bool fetch(const std::string& key, const char* extension, const fs::path& output) const {
+                fs::path entry = dir / (key + extension);
+                std::error_code ec;
+
+                if(!fs::exists(entry, ec)){
+                    return false;
+                }
+
+                fs::remove(output, ec);
+
+                // hardlink when cache and output share a file system, copy otherwise
+                fs::create_hard_link(entry, output, ec);
+
+                if(ec){
+                    ec.clear();
+                    fs::copy_file(entry, output, fs::copy_options::overwrite_existing, ec);
+                }
+
+                return !ec;
+            }
+
+            /*
+                add a freshly written output under `key`, a failure only means the next run misses
+            */
+            void store(const std::string& key, const char* extension, const fs::path& output) const {
+                fs::path entry = dir / (key + extension);
+                fs::path temp = dir / (key + extension + ".tmp" + std::to_string(temp_counter++) + "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())));
+                std::error_code ec;
+
+                fs::create_hard_link(output, temp, ec);
+
+                if(ec){
+                    ec.clear();
+                    fs::copy_file(output, temp, fs::copy_options::overwrite_existing, ec);
+                }
+
+                if(!ec){
+                    fs::rename(temp, entry, ec);
+                }
+
+                if(ec){
+                    fs::remove(temp, ec);
+                    WARNING("Could not add " + output.string() + " to the cache in " + dir.string());
+                }
+            }
+
+        private:
+            fs::path dir;
+
+            inline static std::atomic<size_t> temp_counter = 0;
+    };
+
+}
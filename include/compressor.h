@@ -0,0 +1,502 @@
+#pragma once
+
+#include "disassembler.h"
+
+namespace Assembler {
+
+    /*
+        RV64C, the 16 bit forms of common instructions. Every compressed form is one `C_form`: the
+        instruction it stands for, its fixed bits, where each register and the immediate go and what they
+        must be. `compress` and `expand` read the same table, so a form can only be emitted the way it is
+        read back
+    */
+
+    /*
+        where a register of a compressed form is. The first three are not encoded, the register must be
+        that one. The 3 bit fields hold x8 to x15
+    */
+    enum C_field : uint8_t {
+        C_ZERO,
+        C_RA,
+        C_SP,
+        C_SAME_AS_RD,
+        C_BITS_11_7,
+        C_BITS_6_2,
+        C_BITS_9_7,
+        C_BITS_4_2,
+    };
+
+    /*
+        Immediate layouts, each lists the immediate bit held by instruction bits 12 down to 2, -1 where
+        the bit holds something else
+    */
+    enum C_imm : uint8_t {
+        C_IMM_NONE,
+        C_IMM_CI,
+        C_IMM_LUI,
+        C_IMM_ADDI16SP,
+        C_IMM_LWSP,
+        C_IMM_LDSP,
+        C_IMM_SWSP,
+        C_IMM_SDSP,
+        C_IMM_ADDI4SPN,
+        C_IMM_LW,
+        C_IMM_LD,
+        C_IMM_J,
+        C_IMM_B,
+        NUM_C_IMMS,
+    };
+
+    inline constexpr std::array<std::array<int8_t, 11>, NUM_C_IMMS> C_IMM_LAYOUTS = {{
+        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+        { 5, -1, -1, -1, -1, -1,  4,  3,  2,  1,  0},
+        {17, -1, -1, -1, -1, -1, 16, 15, 14, 13, 12},
+        { 9, -1, -1, -1, -1, -1,  4,  6,  8,  7,  5},
+        { 5, -1, -1, -1, -1, -1,  4,  3,  2,  7,  6},
+        { 5, -1, -1, -1, -1, -1,  4,  3,  8,  7,  6},
+        { 5,  4,  3,  2,  7,  6, -1, -1, -1, -1, -1},
+        { 5,  4,  3,  8,  7,  6, -1, -1, -1, -1, -1},
+        { 5,  4,  9,  8,  7,  6,  2,  3, -1, -1, -1},
+        { 5,  4,  3, -1, -1, -1,  2,  6, -1, -1, -1},
+        { 5,  4,  3, -1, -1, -1,  7,  6, -1, -1, -1},
+        {11,  4,  9,  8, 10,  6,  7,  3,  2,  1,  5},
+        { 8,  4,  3, -1, -1, -1,  7,  6,  2,  1,  5},
+    }};
+
+    /*
+        width of each layout's immediate, the sign bit of the signed ones is the top bit
+    */
+    inline constexpr auto C_IMM_WIDTHS = [] {
+        std::array<int, NUM_C_IMMS> widths{};
+
+        for(size_t layout = 0; layout < NUM_C_IMMS; ++layout){
+            for(int8_t bit : C_IMM_LAYOUTS[layout]){
+                widths[layout] = (bit + 1 > widths[layout]) ? bit + 1 : widths[layout];
+            }
+        }
+
+        return widths;
+    }();
+
+    template<C_imm L>
+    constexpr U32 scatter_c_imm(U32 imm){
+        U32 bits = 0;
+
+        for(int i = 0; i < 11; ++i){
+            int bit = C_IMM_LAYOUTS[L][i];
+            if(bit >= 0) bits |= ((imm >> bit) & 1) << (12 - i);
+        }
+
+        return bits;
+    }
+
+    template<C_imm L>
+    constexpr U32 gather_c_imm(U32 half){
+        U32 imm = 0;
+
+        for(int i = 0; i < 11; ++i){
+            int bit = C_IMM_LAYOUTS[L][i];
+            if(bit >= 0) imm |= ((half >> (12 - i)) & 1) << bit;
+        }
+
+        return imm;
+    }
+
+    /*
+        `f` called with layout `layout` as a compile time constant. A loop over a layout that is only known
+        at run time costs more than all the rest of `compress`
+    */
+    template<typename F>
+    constexpr U32 with_c_imm(C_imm layout, F f){
+        switch(layout){
+            case C_IMM_NONE: return f(std::integral_constant<C_imm, C_IMM_NONE>{});
+            case C_IMM_CI: return f(std::integral_constant<C_imm, C_IMM_CI>{});
+            case C_IMM_LUI: return f(std::integral_constant<C_imm, C_IMM_LUI>{});
+            case C_IMM_ADDI16SP: return f(std::integral_constant<C_imm, C_IMM_ADDI16SP>{});
+            case C_IMM_LWSP: return f(std::integral_constant<C_imm, C_IMM_LWSP>{});
+            case C_IMM_LDSP: return f(std::integral_constant<C_imm, C_IMM_LDSP>{});
+            case C_IMM_SWSP: return f(std::integral_constant<C_imm, C_IMM_SWSP>{});
+            case C_IMM_SDSP: return f(std::integral_constant<C_imm, C_IMM_SDSP>{});
+            case C_IMM_ADDI4SPN: return f(std::integral_constant<C_imm, C_IMM_ADDI4SPN>{});
+            case C_IMM_LW: return f(std::integral_constant<C_imm, C_IMM_LW>{});
+            case C_IMM_LD: return f(std::integral_constant<C_imm, C_IMM_LD>{});
+            case C_IMM_J: return f(std::integral_constant<C_imm, C_IMM_J>{});
+            case C_IMM_B: return f(std::integral_constant<C_imm, C_IMM_B>{});
+            case NUM_C_IMMS: break;
+        }
+
+        return 0;
+    }
+
+    constexpr U32 scatter_c_imm(C_imm layout, U32 imm){
+        return with_c_imm(layout, [imm](auto L){ return scatter_c_imm<L>(imm); });
+    }
+
+    constexpr U32 gather_c_imm(C_imm layout, U32 half){
+        return with_c_imm(layout, [half](auto L){ return gather_c_imm<L>(half); });
+    }
+
+    /*
+        operands of a form that must not be x0, or 0 for the immediate
+    */
+    enum C_flags : uint8_t {
+        C_NONZERO_RD = 1,
+        C_NONZERO_RS1 = 2,
+        C_NONZERO_RS2 = 4,
+        C_NONZERO_IMM = 8,
+        // c.lui with rd = sp is c.addi16sp
+        C_RD_NOT_SP = 16,
+    };
+
+    struct C_form {
+        Token_kind kind;
+        uint16_t bits;
+        uint16_t mask;
+        C_field rd;
+        C_field rs1;
+        C_field rs2;
+        C_imm imm;
+        bool imm_signed;
+        uint8_t flags;
+    };
+
+    /*
+        In the order `expand` tries them, a form whose operand rules fail gives way to the next one with
+        the same fixed bits: c.nop before c.addi, c.addi16sp before c.lui, c.jr and c.jalr before c.mv
+        and c.add
+    */
+    inline constexpr C_form C_FORMS[] = {
+        // quadrant 0
+        {ADDI,  0x0000, 0xe003, C_BITS_4_2,  C_SP,         C_ZERO,     C_IMM_ADDI4SPN, false, C_NONZERO_IMM},
+        {LW,    0x4000, 0xe003, C_BITS_4_2,  C_BITS_9_7,   C_ZERO,     C_IMM_LW,       false, 0},
+        {LD,    0x6000, 0xe003, C_BITS_4_2,  C_BITS_9_7,   C_ZERO,     C_IMM_LD,       false, 0},
+        {SW,    0xc000, 0xe003, C_ZERO,      C_BITS_9_7,   C_BITS_4_2, C_IMM_LW,       false, 0},
+        {SD,    0xe000, 0xe003, C_ZERO,      C_BITS_9_7,   C_BITS_4_2, C_IMM_LD,       false, 0},
+
+        // quadrant 1
+        {ADDI,  0x0001, 0xffff, C_ZERO,      C_ZERO,       C_ZERO,     C_IMM_NONE,     false, 0},
+        {ADDI,  0x0001, 0xe003, C_BITS_11_7, C_SAME_AS_RD, C_ZERO,     C_IMM_CI,       true,  C_NONZERO_RD | C_NONZERO_IMM},
+        {ADDIW, 0x2001, 0xe003, C_BITS_11_7, C_SAME_AS_RD, C_ZERO,     C_IMM_CI,       true,  C_NONZERO_RD},
+        {ADDI,  0x4001, 0xe003, C_BITS_11_7, C_ZERO,       C_ZERO,     C_IMM_CI,       true,  C_NONZERO_RD},
+        {ADDI,  0x6101, 0xef83, C_SP,        C_SP,         C_ZERO,     C_IMM_ADDI16SP, true,  C_NONZERO_IMM},
+        {LUI,   0x6001, 0xe003, C_BITS_11_7, C_ZERO,       C_ZERO,     C_IMM_LUI,      true,  C_NONZERO_RD | C_RD_NOT_SP | C_NONZERO_IMM},
+        {SRLI,  0x8001, 0xec03, C_BITS_9_7,  C_SAME_AS_RD, C_ZERO,     C_IMM_CI,       false, C_NONZERO_IMM},
+        {SRAI,  0x8401, 0xec03, C_BITS_9_7,  C_SAME_AS_RD, C_ZERO,     C_IMM_CI,       false, C_NONZERO_IMM},
+        {ANDI,  0x8801, 0xec03, C_BITS_9_7,  C_SAME_AS_RD, C_ZERO,     C_IMM_CI,       true,  0},
+        {SUB,   0x8c01, 0xfc63, C_BITS_9_7,  C_SAME_AS_RD, C_BITS_4_2, C_IMM_NONE,     false, 0},
+        {XOR,   0x8c21, 0xfc63, C_BITS_9_7,  C_SAME_AS_RD, C_BITS_4_2, C_IMM_NONE,     false, 0},
+        {OR,    0x8c41, 0xfc63, C_BITS_9_7,  C_SAME_AS_RD, C_BITS_4_2, C_IMM_NONE,     false, 0},
+        {AND,   0x8c61, 0xfc63, C_BITS_9_7,  C_SAME_AS_RD, C_BITS_4_2, C_IMM_NONE,     false, 0},
+        {SUBW,  0x9c01, 0xfc63, C_BITS_9_7,  C_SAME_AS_RD, C_BITS_4_2, C_IMM_NONE,     false, 0},
+        {ADDW,  0x9c21, 0xfc63, C_BITS_9_7,  C_SAME_AS_RD, C_BITS_4_2, C_IMM_NONE,     false, 0},
+        {JAL,   0xa001, 0xe003, C_ZERO,      C_ZERO,       C_ZERO,     C_IMM_J,        true,  0},
+        {BEQ,   0xc001, 0xe003, C_ZERO,      C_BITS_9_7,   C_ZERO,     C_IMM_B,        true,  0},
+        {BNE,   0xe001, 0xe003, C_ZERO,      C_BITS_9_7,   C_ZERO,     C_IMM_B,        true,  0},
+
+        // quadrant 2
+        {SLLI,  0x0002, 0xe003, C_BITS_11_7, C_SAME_AS_RD, C_ZERO,     C_IMM_CI,       false, C_NONZERO_RD | C_NONZERO_IMM},
+        {LW,    0x4002, 0xe003, C_BITS_11_7, C_SP,         C_ZERO,     C_IMM_LWSP,     false, C_NONZERO_RD},
+        {LD,    0x6002, 0xe003, C_BITS_11_7, C_SP,         C_ZERO,     C_IMM_LDSP,     false, C_NONZERO_RD},
+        {JALR,  0x8002, 0xf07f, C_ZERO,      C_BITS_11_7,  C_ZERO,     C_IMM_NONE,     false, C_NONZERO_RS1},
+        {ADD,   0x8002, 0xf003, C_BITS_11_7, C_ZERO,       C_BITS_6_2, C_IMM_NONE,     false, C_NONZERO_RD | C_NONZERO_RS2},
+        {JALR,  0x9002, 0xf07f, C_RA,        C_BITS_11_7,  C_ZERO,     C_IMM_NONE,     false, C_NONZERO_RS1},
+        {ADD,   0x9002, 0xf003, C_BITS_11_7, C_SAME_AS_RD, C_BITS_6_2, C_IMM_NONE,     false, C_NONZERO_RD | C_NONZERO_RS2},
+        {SW,    0xc002, 0xe003, C_ZERO,      C_SP,         C_BITS_6_2, C_IMM_SWSP,     false, 0},
+        {SD,    0xe002, 0xe003, C_ZERO,      C_SP,         C_BITS_6_2, C_IMM_SDSP,     false, 0},
+    };
+
+    inline constexpr size_t NUM_C_FORMS = sizeof(C_FORMS) / sizeof(C_FORMS[0]);
+
+    /*
+        forms of each instruction kind, as indices into `C_FORMS` ending at the first NUM_C_FORMS
+    */
+    inline constexpr auto C_FORMS_BY_KIND = [] {
+        std::array<std::array<uint8_t, 6>, NUM_TOKEN_KINDS> table{};
+
+        for(auto& forms : table){
+            forms.fill(NUM_C_FORMS);
+        }
+
+        for(size_t i = 0; i < NUM_C_FORMS; ++i){
+            auto& forms = table[C_FORMS[i].kind];
+            size_t n = 0;
+
+            while(forms[n] != NUM_C_FORMS) ++n;
+
+            if(n + 1 == forms.size()){
+                throw "too many compressed forms of one instruction";
+            }
+
+            forms[n] = i;
+        }
+
+        return table;
+    }();
+
+    constexpr bool is_c_register(uint8_t reg){
+        return (reg >= 8) && (reg < 16);
+    }
+
+    /*
+        The same instruction as far as anything can tell, in the form a compressed instruction stands for
+        and `expand` gives back: `mv rd, rs`, which is `addi rd, rs, 0`, and `add rd, rs, zero` become
+        `add rd, zero, rs` for c.mv, `addiw rd, zero, imm` becomes `addi` for c.li, and the operands of
+        add, xor, or, and and addw are swapped to have zero or rd first when it is the second one
+    */
+    constexpr Operands compress_alias(Operands o){
+        U32 base = o.base;
+
+        if((base == operands_for(ADDI).base) && (o.imm == 0) && (o.rd != 0) && (o.rs1 != 0)){
+            return Operands{operands_for(ADD).base, 0, o.rd, 0, o.rs1, FORMAT_R};
+        }
+
+        // a 12 bit immediate is already sign extended from bit 31
+        if((base == operands_for(ADDIW).base) && (o.rs1 == 0)){
+            o.base = operands_for(ADDI).base;
+        }
+
+        bool commutative = (base == operands_for(ADD).base) || (base == operands_for(XOR).base) || (base == operands_for(OR).base)
+            || (base == operands_for(AND).base) || (base == operands_for(ADDW).base);
+
+        if(commutative && (o.rs1 != 0) && ((o.rs2 == 0) || ((o.rs2 == o.rd) && (o.rs1 != o.rd)))){
+            std::swap(o.rs1, o.rs2);
+        }
+
+        return o;
+    }
+
+    /*
+        field bits of register `reg` for `field`, one that `C_REGISTER_MASKS` allows there
+    */
+    constexpr U32 place_c_register(C_field field, uint8_t reg){
+        switch(field){
+            case C_ZERO:
+            case C_RA:
+            case C_SP:
+            case C_SAME_AS_RD: return 0;
+            case C_BITS_11_7: return (U32)reg << 7;
+            case C_BITS_6_2: return (U32)reg << 2;
+            case C_BITS_9_7: return (U32)(reg - 8) << 7;
+            case C_BITS_4_2: return (U32)(reg - 8) << 2;
+        }
+
+        return 0;
+    }
+
+    /*
+        Registers each form allows in rd, rs1 and rs2, bit N for xN, all of them for registers the
+        instruction doesn't have. One test for all three is what keeps `compress` quick, most instructions
+        have a register that rules out every form
+    */
+    struct C_register_masks {
+        U32 rd;
+        U32 rs1;
+        U32 rs2;
+        bool rs1_is_rd;
+    };
+
+    inline constexpr auto C_REGISTER_MASKS = [] {
+        std::array<C_register_masks, NUM_C_FORMS> table{};
+
+        auto mask_for = [](C_field field, bool nonzero){
+            switch(field){
+                case C_ZERO:
+                case C_RA:
+                case C_SP: return 1u << field;
+                // checked on its own
+                case C_SAME_AS_RD: return ~0u;
+                case C_BITS_11_7:
+                case C_BITS_6_2: return nonzero ? ~1u : ~0u;
+                case C_BITS_9_7:
+                case C_BITS_4_2: return 0xff00u;
+            }
+
+            return 0u;
+        };
+
+        for(size_t i = 0; i < NUM_C_FORMS; ++i){
+            const C_form& form = C_FORMS[i];
+            Instr_format format = INSTR_FORMATS[form.kind];
+
+            C_register_masks& masks = table[i];
+            masks.rd = ((FORMATS_WITH_RD >> format) & 1) ? mask_for(form.rd, form.flags & C_NONZERO_RD) : ~0u;
+            masks.rs1 = ((FORMATS_WITH_RS1 >> format) & 1) ? mask_for(form.rs1, form.flags & C_NONZERO_RS1) : ~0u;
+            masks.rs2 = ((FORMATS_WITH_RS2 >> format) & 1) ? mask_for(form.rs2, form.flags & C_NONZERO_RS2) : ~0u;
+
+            if(form.flags & C_RD_NOT_SP){
+                masks.rd &= ~(1u << 2);
+            }
+
+            masks.rs1_is_rd = (form.rs1 == C_SAME_AS_RD);
+        }
+
+        return table;
+    }();
+
+    constexpr bool c_registers_fit(size_t index, const Operands& o){
+        const C_register_masks& masks = C_REGISTER_MASKS[index];
+
+        return ((masks.rd >> (o.rd & 31)) & (masks.rs1 >> (o.rs1 & 31)) & (masks.rs2 >> (o.rs2 & 31)) & 1)
+            & (!masks.rs1_is_rd | (o.rs1 == o.rd));
+    }
+
+    constexpr uint8_t read_c_register(C_field field, U32 half, uint8_t rd){
+        switch(field){
+            case C_ZERO:
+            case C_RA:
+            case C_SP: return field;
+            case C_SAME_AS_RD: return rd;
+            case C_BITS_11_7: return (half >> 7) & 0x1f;
+            case C_BITS_6_2: return (half >> 2) & 0x1f;
+            case C_BITS_9_7: return 8 + ((half >> 7) & 0x7);
+            case C_BITS_4_2: return 8 + ((half >> 2) & 0x7);
+        }
+
+        return 0;
+    }
+
+    /*
+        immediate of `o` as the instruction word holds it, see `canonical`
+    */
+    constexpr int32_t c_imm_of(const Operands& o){
+        return canonical(o).imm;
+    }
+
+    constexpr int32_t read_c_imm(const C_form& form, U32 half){
+        U32 imm = gather_c_imm(form.imm, half);
+
+        if(!form.imm_signed){
+            return imm;
+        }
+
+        return sign_extend(imm, C_IMM_WIDTHS[form.imm]);
+    }
+
+    constexpr bool c_operands_allowed(const C_form& form, uint8_t rd, uint8_t rs1, uint8_t rs2, int32_t imm){
+        return !(((form.flags & C_NONZERO_RD) && (rd == 0))
+            || ((form.flags & C_NONZERO_RS1) && (rs1 == 0))
+            || ((form.flags & C_NONZERO_RS2) && (rs2 == 0))
+            || ((form.flags & C_NONZERO_IMM) && (imm == 0))
+            || ((form.flags & C_RD_NOT_SP) && (rd == 2)));
+    }
+
+    /*
+        16 bit form of `C_FORMS[index]` with the operands of `o`, 0 if they don't fit it
+    */
+    constexpr U32 compress_as(size_t index, const Operands& o){
+        const C_form& form = C_FORMS[index];
+
+        if(!c_registers_fit(index, o)){
+            return 0;
+        }
+
+        U32 half = form.bits | place_c_register(form.rd, o.rd) | place_c_register(form.rs1, o.rs1) | place_c_register(form.rs2, o.rs2);
+        int32_t imm = (o.format == FORMAT_R) ? 0 : c_imm_of(o);
+
+        if((form.flags & C_NONZERO_IMM) && (imm == 0)){
+            return 0;
+        }
+
+        // whatever the layout can't hold, bits out of range or below the alignment, doesn't come back
+        U32 imm_bits = scatter_c_imm(form.imm, imm);
+
+        if(read_c_imm(form, imm_bits) != imm){
+            return 0;
+        }
+
+        return half | imm_bits;
+    }
+
+    /*
+        16 bit form of `o`, 0 if it has none
+    */
+    constexpr U32 compress(const Operands& operands){
+        Operands o = compress_alias(operands);
+        const auto& forms = C_FORMS_BY_KIND[decode(o.base).kind];
+
+        for(uint8_t i : forms){
+            if(i == NUM_C_FORMS) break;
+
+            if(U32 half = compress_as(i, o)){
+                return half;
+            }
+        }
+
+        return 0;
+    }
+
+    /*
+        whether `o` has a compressed form once its immediate is right, for branches and jumps whose offset
+        isn't known yet
+    */
+    constexpr bool compressible_with_offset(const Operands& o){
+        Token_kind kind = decode(o.base).kind;
+
+        if(kind == JAL) return o.rd == 0;
+        if((kind == BEQ) || (kind == BNE)) return (o.rs2 == 0) && is_c_register(o.rs1);
+
+        return false;
+    }
+
+    /*
+        reach of c.beqz, c.bnez and c.j
+    */
+    constexpr bool fits_c_branch_offset(int64_t offset){
+        return (offset >= -256) && (offset <= 254);
+    }
+
+    constexpr bool fits_c_jump_offset(int64_t offset){
+        return (offset >= -2048) && (offset <= 2046);
+    }
+
+    /*
+        instructions are 16 bits unless their lowest two bits are both set
+    */
+    constexpr bool is_compressed(U32 word){
+        return (word & 0x3) != 0x3;
+    }
+
+    /*
+        the instruction a 16 bit word stands for, in the form `canonical` gives, see `compress_alias`
+    */
+    constexpr Decoded expand(U32 half){
+        for(const C_form& form : C_FORMS){
+            if((half & form.mask) != form.bits) continue;
+
+            Operands o = operands_for(form.kind);
+            uint8_t rd = read_c_register(form.rd, half, 0);
+            uint8_t rs1 = read_c_register(form.rs1, half, rd);
+            uint8_t rs2 = read_c_register(form.rs2, half, rd);
+            int32_t imm = read_c_imm(form, half);
+
+            if(!c_operands_allowed(form, rd, rs1, rs2, imm)){
+                continue;
+            }
+
+            o.imm = imm;
+            o.rd = rd;
+            o.rs1 = rs1;
+            o.rs2 = rs2;
+
+            return Decoded{form.kind, canonical(o)};
+        }
+
+        return Decoded{};
+    }
+
+    static_assert(compress(Operands{operands_for(ADDI).base, 0, 0, 0, 0, FORMAT_I}) == 0x0001, "nop");
+    static_assert(compress(Operands{operands_for(ADDI).base, 1, 10, 0, 0, FORMAT_I}) == 0x4505, "li a0, 1");
+    static_assert(compress(Operands{operands_for(ADDI).base, 0, 10, 11, 0, FORMAT_I}) == 0x852e, "mv a0, a1");
+    static_assert(compress(Operands{operands_for(ADDI).base, -16, 2, 2, 0, FORMAT_I}) == 0x1141, "addi sp, sp, -16");
+    static_assert(compress(Operands{operands_for(SD).base, 8, 0, 2, 1, FORMAT_S}) == 0xe406, "sd ra, 8(sp)");
+    static_assert(compress(Operands{operands_for(LD).base, 8, 1, 2, 0, FORMAT_I}) == 0x60a2, "ld ra, 8(sp)");
+    static_assert(compress(Operands{operands_for(JALR).base, 0, 0, 1, 0, FORMAT_I}) == 0x8082, "ret");
+    static_assert(compress(Operands{operands_for(BEQ).base, 0, 0, 10, 0, FORMAT_B}) == 0xc101, "beqz a0, 0");
+    static_assert(compress(Operands{operands_for(ADDI).base, 1, 10, 11, 0, FORMAT_I}) == 0, "addi a0, a1, 1");
+    static_assert(compress(Operands{operands_for(LW).base, 2, 10, 2, 0, FORMAT_I}) == 0, "misaligned lw a0, 2(sp)");
+    static_assert(expand(0x1141).operands == canonical(Operands{operands_for(ADDI).base, -16, 2, 2, 0, FORMAT_I}));
+    static_assert(compress(Operands{operands_for(XOR).base, 0, 10, 8, 10, FORMAT_R}) == 0x8d21, "xor a0, s0, a0");
+    static_assert(expand(0x852e).kind == ADD);
+    static_assert(expand(0x0000).kind == _EOF, "the all zero word is illegal");
+
+}
@@ -0,0 +1,449 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include "vector.h"
+
+namespace Assembler {
+
+    /*
+        Decoding of machine code back into `Operands`, driven by the same instructions.def as the lexer and
+        the encoder, so an instruction added there can be assembled, disassembled and verified with no
+        other change
+    */
+
+    constexpr bool is_immediate_shift(U32 opcode, U32 funct3){
+        return ((opcode == 0b0010011) || (opcode == 0b0011011)) && ((funct3 == 1) || (funct3 == 5));
+    }
+
+    /*
+        width of the shift amount of an immediate shift: 6 bits for the 64 bit shifts and for slli.uw, which
+        shifts a 32 bit value into all 64 bits, 5 for the other 32 bit shifts
+    */
+    constexpr int shamt_bits(Token_kind kind){
+        return ((INSTR_ENCODINGS[kind].opcode == 0b0010011) || (kind == SLLI_UW)) ? 6 : 5;
+    }
+
+    /*
+        bits of a word that identify `kind`: the opcode, funct3 unless the format keeps immediate bits there,
+        and funct7, or the bits above the shift amount for the immediate shifts, or the whole immediate of
+        unary instructions
+    */
+    constexpr U32 decode_mask_for(Token_kind kind){
+        const Instruction_encoding& enc = INSTR_ENCODINGS[kind];
+        Instr_format format = INSTR_FORMATS[kind];
+
+        U32 mask = 0x7f;
+
+        if((format != FORMAT_U) && (format != FORMAT_J)){
+            mask |= 0x7 << 12;
+        }
+
+        if(format == FORMAT_R){
+            mask |= 0x7fu << 25;
+
+        } else if (token_is_unary_instr(kind)){
+            mask |= 0xfffu << 20;
+
+        } else if (is_immediate_shift(enc.opcode, enc.funct3)){
+            mask |= ~0u << (20 + shamt_bits(kind));
+        }
+
+        return mask;
+    }
+
+    /*
+        Index into `DECODE_TABLE`: opcode bits 6:2, funct3, bit 30 and bit 25, the only funct7 bits that
+        tell two RV64IM instructions apart
+    */
+    constexpr size_t decode_index(U32 word){
+        return (((word >> 2) & 0x1f) << 5) | (((word >> 12) & 0x7) << 2)
+            | (((word >> 30) & 0x1) << 1) | ((word >> 25) & 0x1);
+    }
+
+    /*
+        An instruction a word can be, going by its `decode_index`. The word is that instruction if its bits
+        under `mask` equal `match`, so for RV64IM one load decides everything. Bit manipulation instructions
+        that share an index with another one, like bseti with slli or clz with cpop, are chained behind it
+        through `next`
+    */
+    struct Decode_entry {
+        U32 mask = 0;
+        U32 match = 1;
+        uint8_t kind = _EOF;
+        uint8_t format = FORMAT_R;
+        // 1 + index into `Decode_table::chained` of the next instruction with this index, 0 if there is none
+        uint16_t next = 0;
+    };
+
+    static_assert(sizeof(Decode_entry) == 12, "chaining keeps decode entries at three words");
+
+    struct Decode_table {
+        std::array<Decode_entry, 1024> entries;
+        std::array<Decode_entry, 128> chained;
+        size_t num_chained = 0;
+    };
+
+    constexpr Decode_table DECODE_TABLE = [] {
+        Decode_table table{};
+
+        auto add_entries = [&](Token_kind kind, U32 mask, U32 match, Instr_format format){
+            // kinds fit in a byte, see `Token_stream`
+            Decode_entry added{mask, match, (uint8_t)kind, (uint8_t)format};
+
+            // every index whose funct3, bit 30 and bit 25 agree with `match` where `mask` has them
+            for(U32 funct3 = 0; funct3 < 8; ++funct3){
+                for(U32 bit30 = 0; bit30 < 2; ++bit30){
+                    for(U32 bit25 = 0; bit25 < 2; ++bit25){
+                        U32 word = (match & ~0x42007000u) | (funct3 << 12) | (bit30 << 30) | (bit25 << 25);
+
+                        if((word & mask) != match) continue;
+
+                        Decode_entry* entry = &table.entries[decode_index(word)];
+
+                        if(entry->kind == _EOF){
+                            *entry = added;
+                            continue;
+                        }
+
+                        // appended, so the base instructions stay first
+                        while(true){
+                            if(((entry->match ^ match) & entry->mask & mask) == 0){
+                                throw "two instructions match the same word";
+                            }
+
+                            if(entry->next == 0) break;
+
+                            entry = &table.chained[entry->next - 1];
+                        }
+
+                        if(table.num_chained == table.chained.size()){
+                            throw "too many chained decode entries";
+                        }
+
+                        table.chained[table.num_chained++] = added;
+                        entry->next = table.num_chained;
+                    }
+                }
+            }
+        };
+
+        auto add = [&](Token_kind kind){
+            U32 mask = decode_mask_for(kind);
+            add_entries(kind, mask, operands_for(kind).base & mask, INSTR_FORMATS[kind]);
+        };
+
+        // the vector opcodes, `decode_vector` takes it from there
+        for(U32 opcode : {0b0000111u, 0b0100111u, 0b1010111u}){
+            add_entries(V_INSTR, 0x7f, opcode, FORMAT_R);
+        }
+
+        #define R_TYPE(kind, ...) add(kind);
+        #define I_TYPE(kind, ...) add(kind);
+        #define S_TYPE(kind, ...) add(kind);
+        #define B_TYPE(kind, ...) add(kind);
+        #define U_TYPE(kind, ...) add(kind);
+        #define J_TYPE(kind, ...) add(kind);
+        #define UNARY(kind, ...) add(kind);
+        #include "instructions.def"
+
+        return table;
+    }();
+
+    constexpr int32_t sign_extend(U32 value, int bits){
+        return (int32_t)(value << (32 - bits)) >> (32 - bits);
+    }
+
+    /*
+        inverse of `encode_imm`, sign extended
+    */
+    template<Instr_format F>
+    constexpr int32_t decode_imm(U32 word){
+        if constexpr (F == FORMAT_I){
+            return sign_extend(word >> 20, 12);
+
+        } else if constexpr (F == FORMAT_S){
+            return sign_extend(((word >> 7) & 0x1f) | (((word >> 25) & 0x7f) << 5), 12);
+
+        } else if constexpr (F == FORMAT_B){
+            return sign_extend((((word >> 8) & 0xf) << 1) | (((word >> 25) & 0x3f) << 5) | (((word >> 7) & 0x1) << 11) | ((word >> 31) << 12), 13);
+
+        } else if constexpr (F == FORMAT_U){
+            return (int32_t)(word & 0xfffff000);
+
+        } else if constexpr (F == FORMAT_J){
+            return sign_extend((((word >> 21) & 0x3ff) << 1) | (((word >> 20) & 0x1) << 11) | (word & 0xff000) | ((word >> 31) << 20), 21);
+
+        } else {
+            return 0;
+        }
+    }
+
+    struct Decoded {
+        // _EOF if the word is not an instruction this assembler knows
+        Token_kind kind = _EOF;
+        Operands operands;
+        // which one if `kind` is V_INSTR
+        Vector_kind vector = NUM_VECTOR_KINDS;
+    };
+
+    /*
+        `decode` of a word with one of the vector opcodes
+    */
+    constexpr Decoded decode_vector(U32 word){
+        uint8_t kind = VECTOR_DECODE_TABLE[vector_decode_index(word)];
+
+        if((kind == NUM_VECTOR_KINDS) || ((word & VECTOR_SPECS[kind].mask) != VECTOR_SPECS[kind].base)){
+            return Decoded{};
+        }
+
+        const Vector_spec& spec = VECTOR_SPECS[kind];
+
+        Operands o;
+        o.format = spec.format;
+        o.rd = (word >> 7) & 0x1f;
+        o.rs1 = (word >> 15) & 0x1f;
+
+        if(spec.format == FORMAT_I){
+            o.base = word & spec.mask;
+            o.imm = decode_imm<FORMAT_I>(word & ~spec.mask);
+        } else {
+            o.base = word & 0xfe00707f;
+            o.rs2 = (word >> 20) & 0x1f;
+        }
+
+        return Decoded{V_INSTR, o, (Vector_kind)kind};
+    }
+
+    /*
+        `operands` encode back to `word`, registers a format doesn't have are 0
+    */
+    constexpr Decoded decode(U32 word){
+        const Decode_entry* chain = &DECODE_TABLE.entries[decode_index(word)];
+
+        while((word & chain->mask) != chain->match){
+            if(chain->next == 0){
+                return Decoded{};
+            }
+
+            chain = &DECODE_TABLE.chained[chain->next - 1];
+        }
+
+        const Decode_entry& entry = *chain;
+
+        if(entry.kind == V_INSTR){
+            return decode_vector(word);
+        }
+
+        Operands o;
+        o.base = entry.match;
+        o.format = entry.format;
+
+        // funct7 bits of the shifts and the fixed immediate of unary instructions sit where the immediate would be
+        U32 fields = word & ~entry.mask;
+        U32 f = o.format;
+
+        // without branches like `encode`, the format of consecutive words is anyone's guess
+        auto mask_if = [f](U32 formats){ return 0u - ((formats >> f) & 1); };
+
+        o.imm = (decode_imm<FORMAT_I>(fields) & mask_if(1 << FORMAT_I))
+            | (decode_imm<FORMAT_S>(fields) & mask_if(1 << FORMAT_S))
+            | (decode_imm<FORMAT_B>(fields) & mask_if(1 << FORMAT_B))
+            | (decode_imm<FORMAT_U>(fields) & mask_if(1 << FORMAT_U))
+            | (decode_imm<FORMAT_J>(fields) & mask_if(1 << FORMAT_J));
+
+        o.rd = ((word >> 7) & 0x1f) & mask_if(FORMATS_WITH_RD);
+        o.rs1 = ((word >> 15) & 0x1f) & mask_if(FORMATS_WITH_RS1);
+        o.rs2 = ((word >> 20) & 0x1f) & mask_if(FORMATS_WITH_RS2);
+
+        return Decoded{(Token_kind)entry.kind, o};
+    }
+
+    static_assert(decode(0xfff00513).kind == ADDI && decode(0xfff00513).operands.imm == -1);
+    static_assert(decode(0x4032d293).kind == SRAI && decode(0x4032d293).operands.imm == 3);
+    static_assert(decode(0x0232d293).kind == SRLI && decode(0x0232d293).operands.imm == 35);
+    static_assert(decode(0x0232d29b).kind == _EOF, "srliw has no 6th shamt bit");
+    static_assert(decode(0xfe0a1ce3).kind == BNE && decode(0xfe0a1ce3).operands.imm == -8);
+    static_assert(decode(0xffdff06f).kind == JAL && decode(0xffdff06f).operands.imm == -4);
+    static_assert(decode(0x00752623).kind == SW && decode(0x00752623).operands.imm == 12);
+    static_assert(decode(0x100009b7).kind == LUI && decode(0x100009b7).operands.rd == 19);
+    static_assert(decode(0x02000033).kind == MUL, "funct7 0x01 is RV64M, not add");
+    static_assert(decode(0x02b54533).kind == DIV && decode(0x02b54533).operands.rs2 == 11);
+    static_assert(decode(0x02c5f5bb).kind == REMUW);
+    static_assert(decode(0x0600003b).kind == _EOF, "funct7 0x03 is nothing");
+    static_assert(decode(0x60259513).kind == CPOP && decode(0x60259513).operands.imm == 0, "cpop a0, a1");
+    static_assert(decode(0x60059513).kind == CLZ && decode(0x60159513).kind == CTZ);
+    static_assert(decode(0x6b855513).kind == REV8 && decode(0x28755513).kind == ORC_B);
+    static_assert(decode(0x0a95151b).kind == SLLI_UW && decode(0x0a95151b).operands.imm == 41, "slli.uw a0, a0, 41");
+    static_assert(decode(0x2a051513).kind == BSETI && decode(0x2a051513).operands.imm == 32, "bseti a0, a0, 32");
+    static_assert(decode(0x60155513).kind == RORI && decode(0x60155513).operands.imm == 1);
+    static_assert(decode(0x02051513).kind == SLLI, "slli still comes first in its chain");
+    static_assert(decode(0x20b54533).kind == SH2ADD && decode(0x08b5053b).kind == ADD_UW);
+    static_assert(decode(0x28b51533).kind == BSET && decode(0x0ab56533).kind == MAX);
+    static_assert(decode(0x60359513).kind == _EOF, "no unary instruction has rs2 3");
+    static_assert(decode(0x0d0572d7).vector == VSETVLI && decode(0x0d0572d7).operands.imm == 0xd0);
+    static_assert(decode(0xc073f557).vector == VSETIVLI && decode(0xc073f557).operands.rs1 == 7);
+    static_assert(decode(0xb465e257).vector == VMACC_VX && decode(0xb465e257).operands.rs2 == 6);
+    static_assert(decode(0x02056407).vector == VLE32_V);
+    static_assert(decode(0x02156407).kind == _EOF, "lumop 1 is a whole register load");
+    static_assert(decode(0).kind == _EOF);
+    static_assert(decode(0xffffffff).kind == _EOF);
+
+    /*
+        `operands` as the instruction word holds them, what `decode` gives back if the encoder is right.
+        I and S immediates keep their lower 12 bits and U immediates their upper 20, which is how `li`, `la`
+        and label addresses use them. Branch and jump offsets are kept whole, so one that is out of range
+        doesn't compare equal
+    */
+    constexpr Operands canonical(Operands o){
+        switch(o.format){
+            case FORMAT_I:
+            case FORMAT_S: o.imm = sign_extend(o.imm, 12); break;
+            case FORMAT_U: o.imm = (int32_t)((U32)o.imm & 0xfffff000); break;
+            case FORMAT_R: o.imm = 0; break;
+        }
+
+        if(!((FORMATS_WITH_RD >> o.format) & 1)) o.rd = 0;
+        if(!((FORMATS_WITH_RS1 >> o.format) & 1)) o.rs1 = 0;
+        if(!((FORMATS_WITH_RS2 >> o.format) & 1)) o.rs2 = 0;
+
+        return o;
+    }
+
+    constexpr auto MNEMONICS = [] {
+        std::array<const char*, NUM_TOKEN_KINDS> table{};
+
+        #define R_TYPE(kind, mnemonic, ...) table[kind] = mnemonic;
+        #define I_TYPE(kind, mnemonic, ...) table[kind] = mnemonic;
+        #define S_TYPE(kind, mnemonic, ...) table[kind] = mnemonic;
+        #define B_TYPE(kind, mnemonic, ...) table[kind] = mnemonic;
+        #define U_TYPE(kind, mnemonic, ...) table[kind] = mnemonic;
+        #define J_TYPE(kind, mnemonic, ...) table[kind] = mnemonic;
+        #define UNARY(kind, mnemonic, ...) table[kind] = mnemonic;
+        #include "instructions.def"
+
+        return table;
+    }();
+
+    /*
+        ABI name of every register, the first alias after the xN spelling
+    */
+    constexpr auto REGISTER_NAMES = [] {
+        std::array<const char*, 32> names{};
+
+        for(const detail::Register_spec& spec : detail::REGISTER_SPECS){
+            names[spec.number] = (spec.aliases[1] != nullptr) ? spec.aliases[1] : spec.aliases[0];
+        }
+
+        return names;
+    }();
+
+    /*
+        vtypei as the words `parse_vtype` reads, or as a number if it sets reserved bits
+    */
+    inline std::string vtype_to_string(U32 vtype){
+        if((vtype >> 8) || ((vtype & VTYPE_SEW) > (3 << 3)) || ((vtype & VTYPE_LMUL) == 4)){
+            return std::to_string(vtype);
+        }
+
+        std::string text;
+
+        for(U32 field : {VTYPE_SEW, VTYPE_LMUL, VTYPE_TAIL, VTYPE_MASK}){
+            for(const Vtype_word& word : VTYPE_WORDS){
+                if((word.field == field) && (word.bits == (vtype & field))){
+                    text += (text.empty() ? "" : ", ") + std::string(word.spelling);
+                }
+            }
+        }
+
+        return text;
+    }
+
+    inline std::string vector_to_string(const Decoded& d){
+        const Operands& o = d.operands;
+        Vector_form form = VECTOR_SPECS[d.vector].form;
+
+        auto reg = [](uint8_t r){ return std::string(REGISTER_NAMES[r]); };
+        auto vreg = [](uint8_t r){ return "v" + std::to_string(r); };
+
+        std::string text = std::string(VECTOR_MNEMONICS[d.vector]) + " ";
+        std::string imm5 = std::to_string(sign_extend(o.rs1, 5));
+        std::string address = "(" + reg(o.rs1) + ")";
+
+        switch(form){
+            case VFORM_VV: text += vreg(o.rd) + ", " + vreg(o.rs2) + ", " + vreg(o.rs1); break;
+            case VFORM_VX: text += vreg(o.rd) + ", " + vreg(o.rs2) + ", " + reg(o.rs1); break;
+            case VFORM_VI: text += vreg(o.rd) + ", " + vreg(o.rs2) + ", " + imm5; break;
+            case VFORM_VI_UNSIGNED: text += vreg(o.rd) + ", " + vreg(o.rs2) + ", " + std::to_string(o.rs1); break;
+            case VFORM_MACC_VV: text += vreg(o.rd) + ", " + vreg(o.rs1) + ", " + vreg(o.rs2); break;
+            case VFORM_MACC_VX: text += vreg(o.rd) + ", " + reg(o.rs1) + ", " + vreg(o.rs2); break;
+            case VFORM_VVM: text += vreg(o.rd) + ", " + vreg(o.rs2) + ", " + vreg(o.rs1) + ", v0"; break;
+            case VFORM_VXM: text += vreg(o.rd) + ", " + vreg(o.rs2) + ", " + reg(o.rs1) + ", v0"; break;
+            case VFORM_VIM: text += vreg(o.rd) + ", " + vreg(o.rs2) + ", " + imm5 + ", v0"; break;
+            case VFORM_MV_V: text += vreg(o.rd) + ", " + vreg(o.rs1); break;
+            case VFORM_MV_X:
+            case VFORM_S_X: text += vreg(o.rd) + ", " + reg(o.rs1); break;
+            case VFORM_MV_I: text += vreg(o.rd) + ", " + imm5; break;
+            case VFORM_X_S: text += reg(o.rd) + ", " + vreg(o.rs2); break;
+            case VFORM_UNIT: text += vreg(o.rd) + ", " + address; break;
+            case VFORM_STRIDED: text += vreg(o.rd) + ", " + address + ", " + reg(o.rs2); break;
+            case VFORM_INDEXED: text += vreg(o.rd) + ", " + address + ", " + vreg(o.rs2); break;
+            case VFORM_SETVLI: text += reg(o.rd) + ", " + reg(o.rs1) + ", " + vtype_to_string(o.imm); break;
+            case VFORM_SETIVLI: text += reg(o.rd) + ", " + std::to_string(o.rs1) + ", " + vtype_to_string(o.imm); break;
+            case VFORM_SETVL: text += reg(o.rd) + ", " + reg(o.rs1) + ", " + reg(o.rs2); break;
+        }
+
+        if(vector_form_is_maskable(form) && !(o.base & VM_BIT)){
+            text += ", v0.t";
+        }
+
+        return text;
+    }
+
+    /*
+        Assembly text of a decoded instruction, in the syntax the lexer reads, except that branch and jump
+        targets are byte offsets from the instruction like objdump prints them
+    */
+    inline std::string to_string(const Decoded& d){
+        if(d.kind == _EOF){
+            return "<unknown>";
+        }
+
+        if(d.kind == V_INSTR){
+            return vector_to_string(d);
+        }
+
+        const Operands& o = d.operands;
+        std::string text = MNEMONICS[d.kind];
+        std::string imm = std::to_string(o.imm);
+        U32 opcode = o.base & 0x7f;
+
+        auto reg = [](uint8_t r){ return std::string(REGISTER_NAMES[r]); };
+
+        char upper[16];
+        std::snprintf(upper, sizeof(upper), "0x%x", (U32)o.imm >> 12);
+
+        switch(o.format){
+            case FORMAT_R: return text + " " + reg(o.rd) + ", " + reg(o.rs1) + ", " + reg(o.rs2);
+            case FORMAT_S: return text + " " + reg(o.rs2) + ", " + imm + "(" + reg(o.rs1) + ")";
+            case FORMAT_B: return text + " " + reg(o.rs1) + ", " + reg(o.rs2) + ", " + imm;
+            case FORMAT_U: return text + " " + reg(o.rd) + ", " + upper;
+            case FORMAT_J: return text + " " + reg(o.rd) + ", " + imm;
+        }
+
+        if(opcode == 0b0000011){
+            return text + " " + reg(o.rd) + ", " + imm + "(" + reg(o.rs1) + ")";
+        }
+
+        if(token_is_unary_instr(d.kind)){
+            return text + " " + reg(o.rd) + ", " + reg(o.rs1);
+        }
+
+        return text + " " + reg(o.rd) + ", " + reg(o.rs1) + ", " + imm;
+    }
+
+    inline std::string disassemble(U32 word){
+        return to_string(decode(word));
+    }
+
+}
@@ -0,0 +1,581 @@
+#pragma once
+
+#include <glob.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "assembler.h"
+#include "stats.h"
+#include "cache.h"
+#include "simulator.h"
+#include "thread_pool.h"
+
+namespace Assembler {
+
+    struct Driver_options {
+        std::vector<std::string> inputs;
+        std::optional<fs::path> output_dir;
+        size_t jobs = 1;
+        std::string format = "hex";
+        Log_level log_level = LOG_INFO;
+        bool stats_json = false;
+        bool verify = false;
+        bool compress = false;
+        // `Bitmanip_extension`s `li` may use
+        uint8_t bitmanip = 0;
+        Pool_placement pools = POOLS_OFF;
+        Pool_policy pool_policy = POOL_FOR_LATENCY;
+        std::optional<fs::path> cache_dir;
+        // empty for stdin/stdout, otherwise the path of a Unix socket
+        std::optional<std::string> serve;
+    };
+
+    inline void print_usage(const char* prog){
+        std::cerr << "Usage: " << prog << " [options] [file|dir|glob ...]" << std::endl
+                  << "       " << prog << " run [options] <file|dir|glob ...>, see " << prog << " run --help" << std::endl
+                  << std::endl
+                  << "Assembles every input file, directories contribute all of their .asm files." << std::endl
+                  << "With no inputs, ../assembly_files is assembled." << std::endl
+                  << std::endl
+                  << "Options:" << std::endl
+                  << "  -o <dir>      write output files into <dir> instead of next to each input" << std::endl
+                  << "  -j <n>        assemble up to <n> files in parallel (default 1)" << std::endl
+                  << "  --format=<f>  output format: hex (default, .txt), bin (.bin), ihex (.hex) or elf (.o)" << std::endl
+                  << "  --cache <dir> reuse outputs of unchanged inputs from <dir>, and add new ones to it" << std::endl
+                  << "  --serve[=<s>] keep running and answer framed requests on stdin, or from up to -j clients" << std::endl
+                  << "                at a time on the Unix socket <s>, see server.h for the protocol" << std::endl
+                  << "  --compress    emit the 16 bit RVC form of every instruction that has one" << std::endl
+                  << "  --bitmanip[=<l>]" << std::endl
+                  << "                let li use zba, zbb and zbs, or the ones in the comma separated list <l>" << std::endl
+                  << "  --literal-pools[=<p>]" << std::endl
+                  << "                load large numbers of li from a pool after each function (<p> = function, the" << std::endl
+                  << "                default) or after the code (<p> = section)" << std::endl
+                  << "  --pool-policy=<p>" << std::endl
+                  << "                pool the numbers li takes 5 or more instructions for (<p> = latency, the default)" << std::endl
+                  << "                or every number the load takes fewer bytes for (<p> = size)" << std::endl
+                  << "  --verify      decode every output word again and fail if it differs from the source" << std::endl
+                  << "  --stats=json  print per file and total phase times and counters as JSON once done" << std::endl
+                  << "  -q            only print errors" << std::endl
+                  << "  -v, -vv       also print the symbol table of each file, -vv also traces every instruction" << std::endl
+                  << "  -h, --help    show this message" << std::endl;
+    }
+
+    /*
+        `--bitmanip` or `--bitmanip=zba,zbs` into a set of `Bitmanip_extension`s, false if it names anything else
+    */
+    inline bool parse_bitmanip(const std::string& arg, uint8_t& extensions){
+        if(arg == "--bitmanip"){
+            extensions = EXT_BITMANIP;
+            return true;
+        }
+
+        std::stringstream list(arg.substr(arg.find('=') + 1));
+        std::string name;
+
+        extensions = 0;
+
+        while(std::getline(list, name, ',')){
+            if(name == "zba"){
+                extensions |= EXT_ZBA;
+            } else if (name == "zbb"){
+                extensions |= EXT_ZBB;
+            } else if (name == "zbs"){
+                extensions |= EXT_ZBS;
+            } else {
+                std::cerr << "Unknown extension " << name << ", expected zba, zbb or zbs" << std::endl;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /*
+        `--literal-pools`, `--literal-pools=<placement>` or `--pool-policy=<policy>`, false for anything else
+    */
+    inline bool parse_pool_option(const std::string& arg, Pool_placement& placement, Pool_policy& policy){
+        std::string value = arg.substr(std::min(arg.find('='), arg.size() - 1) + 1);
+
+        if(arg.rfind("--pool-policy=", 0) == 0){
+            if(value == "latency"){
+                policy = POOL_FOR_LATENCY;
+            } else if (value == "size"){
+                policy = POOL_FOR_SIZE;
+            } else {
+                std::cerr << "Unknown pool policy " << value << ", expected latency or size" << std::endl;
+                return false;
+            }
+
+        } else if ((arg == "--literal-pools") || (value == "function")){
+            placement = POOLS_PER_FUNCTION;
+
+        } else if (value == "section"){
+            placement = POOLS_PER_SECTION;
+
+        } else {
+            std::cerr << "Unknown pool placement " << value << ", expected function or section" << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    /*
+        returns false if the arguments are invalid or only help was asked for
+    */
+    inline bool parse_args(int argc, char* argv[], Driver_options& options){
+
+        for(int i = 1; i < argc; ++i){
+            std::string arg = argv[i];
+
+            if((arg == "-h") || (arg == "--help")){
+                print_usage(argv[0]);
+                return false;
+
+            } else if (arg == "--cache"){
+                if(i + 1 == argc){
+                    std::cerr << "--cache needs a directory" << std::endl;
+                    return false;
+                }
+
+                options.cache_dir = fs::path(argv[++i]);
+
+            } else if (arg == "--serve"){
+                options.serve = "";
+
+            } else if (arg.rfind("--serve=", 0) == 0){
+                options.serve = arg.substr(8);
+
+            } else if (arg.rfind("--stats=", 0) == 0){
+                if(arg != "--stats=json"){
+                    std::cerr << "Unknown stats format " << arg.substr(8) << ", expected json" << std::endl;
+                    return false;
+                }
+
+                options.stats_json = true;
+
+            } else if (arg == "--verify"){
+                options.verify = true;
+
+            } else if (arg == "--compress"){
+                options.compress = true;
+
+            } else if ((arg == "--bitmanip") || (arg.rfind("--bitmanip=", 0) == 0)){
+                if(!parse_bitmanip(arg, options.bitmanip)) return false;
+
+            } else if ((arg == "--literal-pools") || (arg.rfind("--literal-pools=", 0) == 0) || (arg.rfind("--pool-policy=", 0) == 0)){
+                if(!parse_pool_option(arg, options.pools, options.pool_policy)) return false;
+
+            } else if (arg == "-q"){
+                options.log_level = LOG_ERROR;
+
+            } else if (arg == "-v"){
+                options.log_level = LOG_DEBUG;
+
+            } else if (arg == "-vv"){
+                options.log_level = LOG_TRACE;
+
+            } else if (arg == "-o"){
+                if(i + 1 == argc){
+                    std::cerr << "-o needs a directory" << std::endl;
+                    return false;
+                }
+
+                options.output_dir = fs::path(argv[++i]);
+            
+            } else if (arg.rfind("-j", 0) == 0){
+                std::string value = (arg.size() > 2) ? arg.substr(2) : ((i + 1 < argc) ? argv[++i] : "");
+                size_t jobs = 0;
+
+                auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), jobs);
+
+                if((ec != std::errc()) || (ptr != value.data() + value.size()) || (jobs == 0)){
+                    std::cerr << "-j needs a positive number of jobs" << std::endl;
+                    return false;
+                }
+
+                options.jobs = jobs;
+
+            } else if (arg.rfind("--format=", 0) == 0){
+                options.format = arg.substr(9);
+
+                if(make_writer(options.format) == nullptr){
+                    std::cerr << "Unknown format " << options.format << ", expected hex, bin, ihex or elf" << std::endl;
+                    return false;
+                }
+
+            } else if ((arg.size() > 1) && (arg[0] == '-')){
+                std::cerr << "Unknown option " << arg << std::endl;
+                print_usage(argv[0]);
+                return false;
+
+            } else {
+                options.inputs.push_back(arg);
+            }
+        }
+
+        if(options.inputs.empty()){
+            options.inputs.push_back("../assembly_files");
+        }
+
+        return true;
+    }
+
+    /*
+        files are taken as given, directories contribute their .asm files in name order,
+        anything with glob characters is expanded by glob(3)
+    */
+    inline std::vector<fs::path> expand_inputs(const std::vector<std::string>& inputs){
+        std::vector<fs::path> files;
+
+        for(const std::string& input : inputs){
+
+            if(fs::is_directory(input)){
+                std::vector<fs::path> dir_files;
+
+                for(auto& file : fs::directory_iterator(fs::path(input))){
+                    if(file.is_regular_file() && (file.path().extension() == ".asm")){
+                        dir_files.push_back(file.path());
+                    }
+                }
+
+                std::sort(dir_files.begin(), dir_files.end());
+                files.insert(files.end(), dir_files.begin(), dir_files.end());
+
+            } else if (input.find_first_of("*?[") != std::string::npos){
+                glob_t matches;
+
+                if(glob(input.c_str(), 0, nullptr, &matches) == 0){
+                    for(size_t i = 0; i < matches.gl_pathc; ++i){
+                        if(fs::is_regular_file(matches.gl_pathv[i])){
+                            files.push_back(matches.gl_pathv[i]);
+                        }
+                    }
+                } else {
+                    WARNING("No files match " + input);
+                }
+
+                globfree(&matches);
+
+            } else {
+                files.push_back(input);
+            }
+        }
+
+        return files;
+    }
+
+    /*
+        colour and assembler source locations only for people reading stderr, see `Log_streams::plain`
+    */
+    inline bool plain_diagnostics(){
+        return !isatty(STDERR_FILENO);
+    }
+
+    /*
+        Assembles a list of files, in parallel when `jobs` > 1. Each file's log output is buffered and printed
+        as one block, in input order, so the console output is the same for any number of jobs
+    */
+    class Driver {
+
+        public:
+            explicit Driver(const Driver_options& _options) :
+                options(_options),
+                writer(make_writer(options.format))
+            {
+                log_level = options.log_level;
+
+                if(writer == nullptr){
+                    PANIC("Unknown output format " + options.format);
+                }
+
+                if(options.cache_dir.has_value()){
+                    cache.emplace(options.cache_dir.value());
+                }
+            }
+
+            int run(){
+                Stopwatch wall_time;
+                std::vector<fs::path> files = expand_inputs(options.inputs);
+
+                if(options.output_dir.has_value()){
+                    fs::create_directories(options.output_dir.value());
+                }
+
+                // spare threads go to splitting up the lexing of each file
+                lex_threads = std::max<size_t>(options.jobs / std::max<size_t>(files.size(), 1), 1);
+
+                results = std::vector<File_result>(files.size());
+                next_to_print = 0;
+
+                {
+                    Thread_pool pool(std::min(options.jobs, std::max<size_t>(files.size(), 1)));
+
+                    for(size_t i = 0; i < files.size(); ++i){
+                        pool.submit([this, i, &files]{
+                            assemble_file(files[i], results[i]);
+                            finish(i);
+                        });
+                    }
+
+                    pool.wait();
+                }
+
+                size_t failed = std::count_if(results.begin(), results.end(), [](const File_result& r){ return !r.stats.ok; });
+
+                if(options.stats_json){
+                    std::vector<File_stats> stats;
+
+                    for(const File_result& r : results){
+                        stats.push_back(r.stats);
+                    }
+
+                    std::cout << stats_to_json(stats, wall_time.seconds()) << std::flush;
+                }
+
+                return (failed == 0) ? 0 : 1;
+            }
+
+        private:
+            struct File_result {
+                std::ostringstream out;
+                std::ostringstream err;
+                File_stats stats;
+                bool done = false;
+            };
+
+            fs::path output_path_for(const fs::path& input) const {
+                return options.output_dir.has_value() ? (options.output_dir.value() / input.filename()) : input;
+            }
+
+            /*
+                every option that changes the output of a file, part of the cache key
+            */
+            std::string output_options() const {
+                return "format=" + options.format + (options.compress ? " compress" : "")
+                    + (options.bitmanip ? " bitmanip=" + std::to_string(options.bitmanip) : "")
+                    + (options.pools ? " pools=" + std::to_string(options.pools) + " policy=" + std::to_string(options.pool_policy) : "");
+            }
+
+            void assemble_file(const fs::path& input, File_result& result){
+                log_streams = Log_streams{&result.out, &result.err, plain_diagnostics(), input.string()};
+
+                INFO("Assembling: " << input.string());
+
+                File_stats& stats = result.stats;
+                stats.file = input.string();
+
+                try {
+                    Stopwatch lex_time;
+                    auto source = std::make_shared<const Source_file>(input);
+
+                    std::string key;
+                    fs::path output = output_path_for(input).replace_extension(writer->extension());
+
+                    if(cache.has_value()){
+                        key = cache->key(source->text(), output_options());
+
+                        if(cache->fetch(key, writer->extension(), output)){
+                            INFO("Unchanged, taken from the cache");
+
+                            stats.cached = true;
+                            stats.ok = true;
+                            log_streams = Log_streams{};
+                            return;
+                        }
+                    }
+
+                    Lexer lexer(source, lex_threads);
+                    stats.lex_seconds = lex_time.seconds();
+
+                    Assembler assembler(lexer.take_tokens(), output_path_for(input));
+                    assembler.run(Assemble_options{options.compress, options.bitmanip, options.pools, options.pool_policy, options.verify});
+
+                    assembler.collect_stats(stats);
+
+                    Stopwatch write_time;
+                    stats.bytes_written = assembler.write(*writer);
+                    stats.write_seconds = write_time.seconds();
+
+                    if(cache.has_value()){
+                        cache->store(key, writer->extension(), output);
+                    }
+
+                    stats.ok = true;
+
+                } catch (const Fatal_error&){
+                    // already reported by PANIC
+                
+                } catch (const std::exception& e){
+                    ERROR(e.what());
+                }
+
+                log_streams = Log_streams{};
+            }
+
+            /*
+                mark file `i` as done and print every finished file that is next in input order
+            */
+            void finish(size_t i){
+                std::lock_guard<std::mutex> lock(print_mutex);
+
+                results[i].done = true;
+
+                while((next_to_print < results.size()) && results[next_to_print].done){
+                    File_result& r = results[next_to_print++];
+
+                    std::cout << r.out.str() << std::flush;
+                    std::cerr << r.err.str() << std::flush;
+
+                    r.out = std::ostringstream();
+                    r.err = std::ostringstream();
+                }
+            }
+
+            Driver_options options;
+            size_t lex_threads = 1;
+            std::unique_ptr<Code_writer> writer;
+            std::optional<Build_cache> cache;
+
+            std::vector<File_result> results;
+            std::mutex print_mutex;
+            size_t next_to_print = 0;
+    };
+
+    struct Run_options {
+        std::vector<std::string> inputs;
+        Sim_options sim;
+        Log_level log_level = LOG_INFO;
+        uint8_t bitmanip = 0;
+        Pool_placement pools = POOLS_OFF;
+        Pool_policy pool_policy = POOL_FOR_LATENCY;
+    };
+
+    inline void print_run_usage(const char* prog){
+        std::cerr << "Usage: " << prog << " run [options] <file|dir|glob ...>" << std::endl
+                  << std::endl
+                  << "Assembles every input in memory, runs it on the built in RV64IM simulator, Zba, Zbb and Zbs included, and prints its registers." << std::endl
+                  << "A run ends at the end of the program, at a jump to itself, at the instruction limit or on a trap." << std::endl
+                  << "The exit code is 1 if any input fails to assemble or traps." << std::endl
+                  << std::endl
+                  << "Options:" << std::endl
+                  << "  --max-instructions <n>  stop each program after <n> instructions, 0 for no limit (default 100000000)" << std::endl
+                  << "  --memory <bytes>        memory from address 0, holding a copy of the code (default 16 MiB)" << std::endl
+                  << "  --bitmanip[=<list>]     let li use zba, zbb and zbs, or the ones in the comma separated list" << std::endl
+                  << "  --literal-pools[=<p>]   load large numbers of li from literal pools, as when assembling" << std::endl
+                  << "  --pool-policy=<p>       which numbers go into the pools, as when assembling" << std::endl
+                  << "  -q                      only print errors and the registers" << std::endl
+                  << "  -h, --help              show this message" << std::endl;
+    }
+
+    /*
+        arguments after `run`, returns false if they are invalid or only help was asked for
+    */
+    inline bool parse_run_args(int argc, char* argv[], Run_options& options){
+
+        auto parse_count = [&](int& i, const std::string& arg, U64& value){
+            std::string text = (i + 1 < argc) ? argv[++i] : "";
+            auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+
+            if(text.empty() || (ec != std::errc()) || (ptr != text.data() + text.size())){
+                std::cerr << arg << " needs a number" << std::endl;
+                return false;
+            }
+
+            return true;
+        };
+
+        for(int i = 2; i < argc; ++i){
+            std::string arg = argv[i];
+
+            if((arg == "-h") || (arg == "--help")){
+                print_run_usage(argv[0]);
+                return false;
+
+            } else if (arg == "--max-instructions"){
+                if(!parse_count(i, arg, options.sim.max_instructions)) return false;
+
+            } else if (arg == "--memory"){
+                U64 bytes = 0;
+
+                if(!parse_count(i, arg, bytes)) return false;
+
+                options.sim.memory_size = bytes;
+
+            } else if ((arg == "--bitmanip") || (arg.rfind("--bitmanip=", 0) == 0)){
+                if(!parse_bitmanip(arg, options.bitmanip)) return false;
+
+            } else if ((arg == "--literal-pools") || (arg.rfind("--literal-pools=", 0) == 0) || (arg.rfind("--pool-policy=", 0) == 0)){
+                if(!parse_pool_option(arg, options.pools, options.pool_policy)) return false;
+
+            } else if (arg == "-q"){
+                options.log_level = LOG_ERROR;
+
+            } else if ((arg.size() > 1) && (arg[0] == '-')){
+                std::cerr << "Unknown option " << arg << std::endl;
+                print_run_usage(argv[0]);
+                return false;
+
+            } else {
+                options.inputs.push_back(arg);
+            }
+        }
+
+        if(options.inputs.empty()){
+            print_run_usage(argv[0]);
+            return false;
+        }
+
+        return true;
+    }
+
+    /*
+        the `run` subcommand, one after the other so the register dumps come out in input order
+    */
+    inline int run_programs(const Run_options& options){
+        log_level = options.log_level;
+
+        int status = 0;
+
+        for(const fs::path& input : expand_inputs(options.inputs)){
+            INFO("Running: " << input.string());
+
+            log_streams.plain = plain_diagnostics();
+            log_streams.input = input.string();
+
+            try {
+                Lexer lexer(std::make_shared<const Source_file>(input));
+
+                Assembler assembler(lexer.take_tokens());
+                assembler.run(Assemble_options{false, options.bitmanip, options.pools, options.pool_policy});
+
+                Stopwatch sim_time;
+                Sim_result result = Simulator(assembler.get_code(), options.sim).run();
+                double seconds = sim_time.seconds();
+
+                print_registers(std::cout, result);
+
+                INFO(result.instructions << " instructions in " << seconds << "s");
+
+                if(result.trapped()){
+                    ERROR(to_string(result.exit));
+                    status = 1;
+                }
+
+            } catch (const Fatal_error&){
+                status = 1;
+
+            } catch (const std::exception& e){
+                ERROR(e.what());
+                status = 1;
+            }
+        }
+
+        log_streams = Log_streams{};
+
+        return status;
+    }
+
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <bit>
+#include <cstring>
+#include <type_traits>
+#include "lex.h"
+
+namespace Assembler {
+
+    enum Instr_format : uint8_t {
+        FORMAT_R,
+        FORMAT_I,
+        FORMAT_S,
+        FORMAT_B,
+        FORMAT_U,
+        FORMAT_J,
+        NUM_FORMATS,
+    };
+
+    /*
+        One parsed instruction, everything the encoder needs and nothing else. `base` holds the
+        opcode/funct3/funct7 bits, `imm` is the immediate as written: the value for I and S, the byte offset
+        for B and J and the full 32 bit value, of which the upper 20 bits are used, for U
+    */
+    struct Operands {
+        U32 base = 0;
+        int32_t imm = 0;
+        uint8_t rd = 0;
+        uint8_t rs1 = 0;
+        uint8_t rs2 = 0;
+        uint8_t format = FORMAT_R;
+
+        constexpr bool operator==(const Operands&) const = default;
+    };
+
+    static_assert(sizeof(Operands) == 12, "operand records are packed for encoding");
+
+    /*
+        format of every base instruction kind
+    */
+    constexpr auto INSTR_FORMATS = [] {
+        std::array<Instr_format, NUM_TOKEN_KINDS> table{};
+
+        #define R_TYPE(kind, ...) table[kind] = FORMAT_R;
+        #define I_TYPE(kind, ...) table[kind] = FORMAT_I;
+        #define S_TYPE(kind, ...) table[kind] = FORMAT_S;
+        #define B_TYPE(kind, ...) table[kind] = FORMAT_B;
+        #define U_TYPE(kind, ...) table[kind] = FORMAT_U;
+        #define J_TYPE(kind, ...) table[kind] = FORMAT_J;
+        #define UNARY(kind, ...) table[kind] = FORMAT_I;
+        #include "instructions.def"
+
+        return table;
+    }();
+
+    /*
+        operand record of every base instruction kind with every operand still zero, the fixed immediate of a
+        unary instruction is part of `base`
+    */
+    constexpr auto OPERAND_RECORDS = [] {
+        std::array<Operands, NUM_TOKEN_KINDS> table{};
+
+        for(size_t kind = 0; kind < NUM_TOKEN_KINDS; ++kind){
+            const Instruction_encoding& enc = INSTR_ENCODINGS[kind];
+
+            table[kind].base = enc.opcode | (enc.funct3 << 12) | (enc.rs2 << 20) | (enc.funct7 << 25);
+            table[kind].format = INSTR_FORMATS[kind];
+        }
+
+        return table;
+    }();
+
+    constexpr Operands operands_for(Token_kind kind){
+        return OPERAND_RECORDS[kind];
+    }
+
+    /*
+        immediate layout of each format, placed at its bits in the instruction word
+    */
+    template<Instr_format F>
+    constexpr U32 encode_imm(U32 imm){
+        if constexpr (F == FORMAT_I){
+            return (imm & 0xfff) << 20;
+
+        } else if constexpr (F == FORMAT_S){
+            return ((imm & 0x1f) << 7) | (((imm >> 5) & 0x7f) << 25);
+
+        } else if constexpr (F == FORMAT_B){
+            return (((imm >> 11) & 0x1) << 7) | (((imm >> 1) & 0xf) << 8) | (((imm >> 5) & 0x3f) << 25) | (((imm >> 12) & 0x1) << 31);
+
+        } else if constexpr (F == FORMAT_U){
+            return imm & 0xfffff000;
+
+        } else if constexpr (F == FORMAT_J){
+            // imm[20|10:1|11|19:12]
+            return (imm & 0xff000) | (((imm >> 11) & 0x1) << 20) | (((imm >> 1) & 0x3ff) << 21) | (((imm >> 20) & 0x1) << 31);
+
+        } else {
+            return 0;
+        }
+    }
+
+    /*
+        formats that have each field, as a bit set of `Instr_format`s
+    */
+    inline constexpr U32 FORMATS_WITH_RD = (1 << FORMAT_R) | (1 << FORMAT_I) | (1 << FORMAT_U) | (1 << FORMAT_J);
+    inline constexpr U32 FORMATS_WITH_RS1 = (1 << FORMAT_R) | (1 << FORMAT_I) | (1 << FORMAT_S) | (1 << FORMAT_B);
+    inline constexpr U32 FORMATS_WITH_RS2 = (1 << FORMAT_R) | (1 << FORMAT_S) | (1 << FORMAT_B);
+
+    template<Instr_format F>
+    constexpr U32 encode(const Operands& o){
+        U32 word = o.base | encode_imm<F>(o.imm);
+
+        if constexpr ((FORMATS_WITH_RD >> F) & 1) word |= (U32)o.rd << 7;
+        if constexpr ((FORMATS_WITH_RS1 >> F) & 1) word |= (U32)o.rs1 << 15;
+        if constexpr ((FORMATS_WITH_RS2 >> F) & 1) word |= (U32)o.rs2 << 20;
+
+        return word;
+    }
+
+    /*
+        Any format, without branches: every field and every immediate layout is computed and the ones the
+        format doesn't have are masked off, so a program that mixes formats pays no mispredicted branches.
+        The four byte fields are read as one word
+    */
+    constexpr U32 encode(const Operands& o){
+        U32 fields;
+        U32 imm = o.imm;
+
+        if(std::is_constant_evaluated() || (std::endian::native != std::endian::little)){
+            fields = o.rd | (o.rs1 << 8) | (o.rs2 << 16) | ((U32)o.format << 24);
+        } else {
+            std::memcpy(&fields, &o.rd, 4);
+        }
+
+        U32 f = fields >> 24;
+
+        // compares instead of a shift by `f`, SSE2 has no per lane variable shifts
+        auto mask_if = [f](U32 formats){
+            U32 mask = 0;
+            for(U32 format = 0; format < NUM_FORMATS; ++format){
+                if((formats >> format) & 1) mask |= 0u - (U32)(f == format);
+            }
+            return mask;
+        };
+
+        return o.base
+            | (((fields & 0xff) << 7) & mask_if(FORMATS_WITH_RD))
+            | ((((fields >> 8) & 0xff) << 15) & mask_if(FORMATS_WITH_RS1))
+            | ((((fields >> 16) & 0xff) << 20) & mask_if(FORMATS_WITH_RS2))
+            | (encode_imm<FORMAT_I>(imm) & mask_if(1 << FORMAT_I))
+            | (encode_imm<FORMAT_S>(imm) & mask_if(1 << FORMAT_S))
+            | (encode_imm<FORMAT_B>(imm) & mask_if(1 << FORMAT_B))
+            | (encode_imm<FORMAT_U>(imm) & mask_if(1 << FORMAT_U))
+            | (encode_imm<FORMAT_J>(imm) & mask_if(1 << FORMAT_J));
+    }
+
+
+    static_assert(encode(Operands{operands_for(ADDI).base, -1, 10, 0, 0, FORMAT_I}) == 0xfff00513, "addi a0, zero, -1");
+    static_assert(encode(Operands{operands_for(SW).base, 12, 0, 10, 7, FORMAT_S}) == 0x00752623, "sw t2, 12(a0)");
+    static_assert(encode(Operands{operands_for(BNE).base, -8, 0, 20, 0, FORMAT_B}) == 0xfe0a1ce3, "bne s4, zero, -8");
+    static_assert(encode(Operands{operands_for(LUI).base, 0x10000000, 19, 0, 0, FORMAT_U}) == 0x100009b7, "lui s3, 0x10000");
+    static_assert(encode(Operands{operands_for(JAL).base, -4, 0, 0, 0, FORMAT_J}) == 0xffdff06f, "jal zero, -4");
+    static_assert(encode(Operands{operands_for(SRAI).base, 3, 5, 5, 0, FORMAT_I}) == 0x4032d293, "srai t0, t0, 3");
+    static_assert(encode(Operands{operands_for(CPOP).base, 0, 10, 11, 0, FORMAT_I}) == 0x60259513, "cpop a0, a1");
+    static_assert(encode(Operands{operands_for(SH2ADD).base, 0, 10, 10, 11, FORMAT_R}) == 0x20b54533, "sh2add a0, a0, a1");
+
+    static_assert([]{
+        Operands o{operands_for(BEQ).base, 0x1ffe, 1, 2, 3, FORMAT_B};
+        return encode(o) == encode<FORMAT_B>(o);
+    }());
+
+}
@@ -1,11 +1,17 @@
 #pragma once
 
-#include <regex>
 #include <stdio.h>
 #include <stdlib.h>
 #include <fstream>
 #include <variant>
+#include <array>
+#include <memory>
+#include <sstream>
+#include <algorithm>
 #include "utils.h"
+#include "perfect_hash.h"
+#include "source.h"
+#include "thread_pool.h"
 
 #include "string.h"
 
@@ -23,109 +29,68 @@ namespace Assembler {
             R_TYPE
         */
         R_TYPE_START,
-        ADD,
-        SUB,
-        XOR,
-        OR,
-        AND,
-        SLL,
-        SRL,
-        SRA,
-        SLT,
-        SLTU,
-        ADDW,
-        SUBW,
-        SLLW,
-        SRLW,
-        SRAW,
+        #define R_TYPE(kind, ...) kind,
+        #include "instructions.def"
         R_TYPE_END,
         /*
             I_TYPE
         */
         I_TYPE_START,
-        ADDI,
-        SLLI,
-        SLTI,
-        SLTIU,
-        XORI,
-        ORI,
-        ANDI,
-        SRLI,
-        SRAI,
-        LB,
-        LH,
-        LW,
-        LBU,
-        LHU,
-        JALR,
-        ADDIW,
-        SLLIW,
-        SRLIW,
-        SRAIW,
-        LWU,
-        LD,
+        #define I_TYPE(kind, ...) kind,
+        #include "instructions.def"
         I_TYPE_END,
         /*
             S_TYPE
         */
         S_TYPE_START,
-        SB,
-        SH,
-        SW,
-        SD,
+        #define S_TYPE(kind, ...) kind,
+        #include "instructions.def"
         S_TYPE_END,
         /*
             B_TYPE
         */
         B_TYPE_START,
-        BEQ,
-        BNE,
-        BLT,
-        BGE,
-        BLTU,
-        BGEU,
+        #define B_TYPE(kind, ...) kind,
+        #include "instructions.def"
         B_TYPE_END,
         /*
             U_TYPE
         */
         U_TYPE_START,
-        LUI,
-        AUIPC,
+        #define U_TYPE(kind, ...) kind,
+        #include "instructions.def"
         U_TYPE_END,
         /*
             J_TYPE
         */
         J_TYPE_START,
-        JAL,
+        #define J_TYPE(kind, ...) kind,
+        #include "instructions.def"
         J_TYPE_END,
+        /*
+            UNARY, I types with a fixed immediate
+        */
+        UNARY_START,
+        #define UNARY(kind, ...) kind,
+        #include "instructions.def"
+        UNARY_END,
 
         /*
             base instructions end here
         */
         BASE_INSTR_END,
 
+        /*
+            every vector instruction, the payload of the token says which `Vector_kind`
+        */
+        V_INSTR,
+
         /*
             psuedo instructions start here
         */
         PSEUDO_INSTR_START,
-        LI,
-        LA,
-        MV,
-        NOT,
-        NEG,
-        BGT,
-        BLE,
-        BGTU,
-        BLEU,
-        BEQZ,
-        BNEZ,
-        BGEZ,
-        BLEZ,
-        BGTZ,
-        J,
-        CALL,
-        RET,
-        NOP,
+        #define PSEUDO(kind, mnemonic) kind,
+        #include "instructions.def"
         /*
             psuedo instructions end here
         */
@@ -134,39 +99,15 @@ namespace Assembler {
             Registers
         */
         REG_BEGIN,
-        X0,
-        X1,
-        X2,
-        X3,
-        X4,
-        X5,
-        X6,
-        X7,
-        X8,
-        X9,
-        X10,
-        X11,
-        X12,
-        X13,
-        X14,
-        X15,
-        X16,
-        X17,
-        X18,
-        X19,
-        X20,
-        X21,
-        X22,
-        X23,
-        X24,
-        X25,
-        X26,
-        X27,
-        X28,
-        X29,
-        X30,
-        X31,
+        #define REGISTER(kind, ...) kind,
+        #include "instructions.def"
         REG_END,
+        /*
+            v0-v31 share one kind, the payload is the register number
+        */
+        VREG,
+        // the mask operand `v0.t`
+        V0_T,
         /*
             Other
         */
@@ -180,9 +121,22 @@ namespace Assembler {
         LINE_END,
         LBRACK,
         RBRACK,
+
+        NUM_TOKEN_KINDS
+    };
+
+    /*
+        RVV instructions, kept out of `Token_kind` so that kinds still fit in a byte
+    */
+    enum Vector_kind : uint8_t {
+        #define VECTOR(kind, ...) kind,
+        #include "instructions.def"
+        NUM_VECTOR_KINDS
     };
 
-    inline bool token_kind_is_between(const Token_kind& kind, const Token_kind& kind_start, const Token_kind& kind_end) {
+    static_assert(NUM_VECTOR_KINDS < 256, "vector kinds are stored in a byte");
+
+    constexpr bool token_kind_is_between(const Token_kind& kind, const Token_kind& kind_start, const Token_kind& kind_end) {
         return (kind > kind_start) && (kind < kind_end);
     }
 
@@ -194,325 +148,750 @@ namespace Assembler {
         return token_kind_is_between(kind, PSEUDO_INSTR_START, PSEUDO_INSTR_END);
     }
 
+    constexpr bool token_is_unary_instr(const Token_kind& kind){
+        return token_kind_is_between(kind, UNARY_START, UNARY_END);
+    }
+
     inline bool token_is_reg(const Token_kind& kind){
         return token_kind_is_between(kind, REG_BEGIN, REG_END);
     }
 
-    struct Token{
-        std::variant<U32, Instruction_data, std::string> value;
+    struct Keyword_rule {
+        // lower case spelling, each register alias gets its own rule
+        std::string_view spelling;
         Token_kind kind;
+        // register number of registers, `Vector_kind` of vector instructions
+        uint8_t payload;
+    };
 
-        U32 get_reg_num(){
-            assert(token_is_reg(kind));
-            return std::get<U32>(value);
-        }
+    struct Instruction_encoding {
+        uint8_t opcode;
+        uint8_t funct3;
+        uint8_t funct7;
+        // the fixed rs2 field of unary instructions
+        uint8_t rs2;
+    };
+
+    namespace detail {
+
+        struct Register_spec {
+            Token_kind kind;
+            uint8_t number;
+            std::array<const char*, 3> aliases;
+        };
+
+        constexpr Register_spec REGISTER_SPECS[] = {
+            #define REGISTER(kind, number, ...) {kind, number, {__VA_ARGS__}},
+            #include "instructions.def"
+        };
+
+        constexpr Keyword_rule INSTR_RULES[] = {
+            #define R_TYPE(kind, mnemonic, ...) {mnemonic, kind, 0},
+            #define I_TYPE(kind, mnemonic, ...) {mnemonic, kind, 0},
+            #define S_TYPE(kind, mnemonic, ...) {mnemonic, kind, 0},
+            #define B_TYPE(kind, mnemonic, ...) {mnemonic, kind, 0},
+            #define U_TYPE(kind, mnemonic, ...) {mnemonic, kind, 0},
+            #define J_TYPE(kind, mnemonic, ...) {mnemonic, kind, 0},
+            #define UNARY(kind, mnemonic, ...) {mnemonic, kind, 0},
+            #define PSEUDO(kind, mnemonic) {mnemonic, kind, 0},
+            #define VECTOR(kind, mnemonic, ...) {mnemonic, V_INSTR, kind},
+            #define VREGISTER(number, name) {name, VREG, number},
+            #include "instructions.def"
+            {"v0.t", V0_T, 0},
+        };
+
+        constexpr size_t num_keyword_rules(){
+            size_t n = std::size(INSTR_RULES);
+
+            for(const Register_spec& reg : REGISTER_SPECS){
+                for(const char* alias : reg.aliases){
+                    n += (alias != nullptr);
+                }
+            }
 
-        Instruction_data get_instr_data(){
-            assert(token_is_base_instr(kind) || token_is_pseudo_instr(kind));
-            return std::get<Instruction_data>(value);
+            return n;
         }
 
-        std::string get_string(){
-            assert(std::holds_alternative<std::string>(value));
-            return std::get<std::string>(value);
+    }
+
+    /*
+        every keyword the lexer knows, mnemonics and vector registers first then register aliases
+    */
+    constexpr auto TOKEN_RULES = [] {
+        std::array<Keyword_rule, detail::num_keyword_rules()> rules{};
+        size_t n = 0;
+
+        for(const Keyword_rule& rule : detail::INSTR_RULES){
+            rules[n++] = rule;
         }
 
-        bool operator==(const Token& other) const {
-            return (value == other.value) && (kind == other.kind);
+        for(const detail::Register_spec& reg : detail::REGISTER_SPECS){
+            for(const char* alias : reg.aliases){
+                if(alias != nullptr) rules[n++] = Keyword_rule{alias, reg.kind, reg.number};
+            }
         }
 
-        friend std::ostream& operator<<(std::ostream& stream, const Token& t){
-            stream << t.kind << " ";
+        return rules;
+    }();
 
-            if(token_is_reg(t.kind)){
-                stream << "x";
-            }
+    /*
+        opcode/funct3/funct7, and rs2 of unary instructions, for every instruction kind, zero for pseudo instructions and non instruction tokens
+    */
+    constexpr auto INSTR_ENCODINGS = [] {
+        std::array<Instruction_encoding, NUM_TOKEN_KINDS> table{};
+
+        #define R_TYPE(kind, mnemonic, opcode, funct3, funct7) table[kind] = {opcode, funct3, funct7, 0};
+        #define I_TYPE(kind, mnemonic, opcode, funct3, funct7) table[kind] = {opcode, funct3, funct7, 0};
+        #define S_TYPE(kind, mnemonic, opcode, funct3, funct7) table[kind] = {opcode, funct3, funct7, 0};
+        #define B_TYPE(kind, mnemonic, opcode, funct3, funct7) table[kind] = {opcode, funct3, funct7, 0};
+        #define U_TYPE(kind, mnemonic, opcode, funct3, funct7) table[kind] = {opcode, funct3, funct7, 0};
+        #define J_TYPE(kind, mnemonic, opcode, funct3, funct7) table[kind] = {opcode, funct3, funct7, 0};
+        #define UNARY(kind, mnemonic, opcode, funct3, funct7, rs2) table[kind] = {opcode, funct3, funct7, rs2};
+        #include "instructions.def"
+
+        return table;
+    }();
 
-            std::visit([&](const auto& val) {
-                stream << val;
-            }, t.value);
-            
-            return stream;
+    constexpr auto KEYWORD_HASH = [] {
+        std::array<std::string_view, TOKEN_RULES.size()> keys{};
+
+        for(size_t i = 0; i < TOKEN_RULES.size(); ++i){
+            keys[i] = TOKEN_RULES[i].spelling;
         }
+
+        return Perfect_hash<TOKEN_RULES.size()>(keys);
+    }();
+
+    /*
+        character classes used by the scanner, so that each input byte is classified with one table lookup
+    */
+    enum Char_class : uint8_t {
+        CC_OTHER,
+        CC_SPACE,
+        CC_NEWLINE,
+        CC_IDENT_START,
+        CC_DIGIT,
+        CC_MINUS,
+        CC_COLON,
+        CC_COMMA,
+        CC_DOT,
+        CC_HASH,
+        CC_SLASH,
+        CC_LBRACK,
+        CC_RBRACK,
     };
 
-    struct Regex_matcher {
+    constexpr std::array<Char_class, 256> CHAR_CLASSES = [] {
+        std::array<Char_class, 256> table{};
+
+        for(int c = 'a'; c <= 'z'; ++c) table[c] = CC_IDENT_START;
+        for(int c = 'A'; c <= 'Z'; ++c) table[c] = CC_IDENT_START;
+        for(int c = '0'; c <= '9'; ++c) table[c] = CC_DIGIT;
+
+        table['_'] = CC_IDENT_START;
+        table[' '] = table['\t'] = table['\r'] = table['\v'] = table['\f'] = CC_SPACE;
+        table['\n'] = CC_NEWLINE;
+        table['-'] = CC_MINUS;
+        table[':'] = CC_COLON;
+        table[','] = CC_COMMA;
+        table['.'] = CC_DOT;
+        table['#'] = CC_HASH;
+        table['/'] = CC_SLASH;
+        table['('] = CC_LBRACK;
+        table[')'] = CC_RBRACK;
+
+        return table;
+    }();
 
-        Regex_matcher(const std::string& p, const Token_kind& k){
-            pattern = p;
-            kind = k;
+    /*
+        dots can't start a word but can be part of one, like in `vle32.v` and `v0.t`. One lookup per byte of
+        every word, so it gets its own table
+    */
+    constexpr std::array<bool, 256> IDENT_CHARS = [] {
+        std::array<bool, 256> table{};
 
-            // mod_pattern(match_exact);
+        for(int c = 0; c < 256; ++c){
+            table[c] = (CHAR_CLASSES[c] == CC_IDENT_START) || (CHAR_CLASSES[c] == CC_DIGIT) || (CHAR_CLASSES[c] == CC_DOT);
         }
 
-        Regex_matcher(const std::string& p, const Token_kind& k, const Instruction_data& d){
-            pattern = p;
-            kind = k;
-            replacement_value = std::make_optional<Instruction_data>(d);
+        return table;
+    }();
 
-            // must be an instruction token
-            assert(token_is_base_instr(k) || token_is_pseudo_instr(k));
+    inline bool is_ident_char(char c){
+        return IDENT_CHARS[(unsigned char)c];
+    }
 
-            mod_pattern(true);
-        }
+    inline bool is_hex_digit(char c){
+        return (CHAR_CLASSES[(unsigned char)c] == CC_DIGIT) || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f');
+    }
 
-        Regex_matcher(const std::string& p, const Token_kind& k, U32 reg_num){
-            pattern = p;
-            kind = k;
-            replacement_value = std::make_optional<U32>(reg_num);
-            
-            // must be a register token
-            assert(token_is_reg(k));
+    /*
+        longest keyword spelling, identifiers longer than this can only be labels
+    */
+    constexpr size_t MAX_KEYWORD_LEN = [] {
+        size_t len = 0;
 
-            mod_pattern(true);
+        for(const Keyword_rule& rule : TOKEN_RULES){
+            len = std::max(len, rule.spelling.size());
         }
 
-        void mod_pattern(const bool& match_exact){
+        return len;
+    }();
+
+    /*
+        O(1) case insensitive keyword lookup, no allocation
+    */
+    constexpr const Keyword_rule* find_keyword(const char* text, size_t len){
         
-            if(match_exact){
-                pattern = "^" + pattern + "$";
-            }
+        if(len > MAX_KEYWORD_LEN) return nullptr;
+
+        int index = KEYWORD_HASH.find(std::string_view(text, len));
+
+        if((index >= 0) && keyword_equals(TOKEN_RULES[index].spelling, text, len)){
+            return &TOKEN_RULES[index];
         }
 
-        std::string pattern;
-        Token_kind kind;
+        return nullptr;
+    }
 
-        std::optional<std::variant<U32, Instruction_data, std::string>> replacement_value = std::nullopt;
-    };
-        
-    const std::vector<Regex_matcher> TOKEN_RULES = {
-        /* R_TYPE */
-        Regex_matcher(R"(add)", ADD, Instruction_data(0b0110011, 0x0, 0x00)),
-        Regex_matcher(R"(sub)", SUB, Instruction_data(0b0110011, 0x0, 0x20)),
-        Regex_matcher(R"(xor)", XOR, Instruction_data(0b0110011, 0x4, 0x00)),
-        Regex_matcher(R"(or)",  OR, Instruction_data(0b0110011, 0x6, 0x00)),
-        Regex_matcher(R"(and)", AND, Instruction_data(0b0110011, 0x7, 0x00)),
-        Regex_matcher(R"(sll)", SLL, Instruction_data(0b0110011, 0x1, 0x00)),
-        Regex_matcher(R"(srl)", SRL, Instruction_data(0b0110011, 0x5, 0x00)),
-        Regex_matcher(R"(sra)", SRA, Instruction_data(0b0110011, 0x5, 0x20)),
-        Regex_matcher(R"(slt)", SLT, Instruction_data(0b0110011, 0x2, 0x00)),
-        Regex_matcher(R"(sltu)", SLTU, Instruction_data(0b0110011, 0x3, 0x00)),
-        Regex_matcher(R"(addw)", ADDW, Instruction_data(0b0111011, 0x0, 0x00)),
-        Regex_matcher(R"(subw)", SUBW, Instruction_data(0b0111011, 0x0, 0x20)),
-        Regex_matcher(R"(sllW)", SLLW, Instruction_data(0b0111011, 0x1, 0x00)),
-        Regex_matcher(R"(srlW)", SRLW, Instruction_data(0b0111011, 0x5, 0x00)),
-        Regex_matcher(R"(sraW)", SRAW, Instruction_data(0b0111011, 0x5, 0x20)),
-
-        /* I_TYPE */
-        Regex_matcher(R"(addi)", ADDI, Instruction_data(0b0010011, 0x0, 0x00)),
-        Regex_matcher(R"(slli)", SLLI, Instruction_data(0b0010011, 0x1, 0x00)),
-        Regex_matcher(R"(slti)", SLTI, Instruction_data(0b0010011, 0x2, 0x00)),
-        Regex_matcher(R"(sltiu)", SLTIU, Instruction_data(0b0010011, 0x3, 0x00)),
-        Regex_matcher(R"(xori)", XORI, Instruction_data(0b0010011, 0x4, 0x00)),
-        Regex_matcher(R"(ori)", ORI, Instruction_data(0b0010011, 0x6, 0x00)),
-        Regex_matcher(R"(andi)", ANDI, Instruction_data(0b0010011, 0x7, 0x00)),
-        Regex_matcher(R"(srli)", SRLI, Instruction_data(0b0010011, 0x5, 0x00)),
-        Regex_matcher(R"(srai)", SRAI, Instruction_data(0b0010011, 0x5, 0x20)),
-        Regex_matcher(R"(lb)", LB, Instruction_data(0b0000011, 0x0, 0x00)),
-        Regex_matcher(R"(lh)", LH, Instruction_data(0b0000011, 0x1, 0x00)),
-        Regex_matcher(R"(lw)", LW, Instruction_data(0b0000011, 0x2, 0x00)),
-        Regex_matcher(R"(lbu)", LBU, Instruction_data(0b0000011, 0x4, 0x00)),
-        Regex_matcher(R"(lhu)", LHU, Instruction_data(0b0000011, 0x5, 0x00)),
-        Regex_matcher(R"(jalr)", JALR, Instruction_data(0b1100111, 0x0, 0x00)),
-        Regex_matcher(R"(addiw)", ADDIW, Instruction_data(0b0011011, 0x0, 0x00)),
-        Regex_matcher(R"(slliw)", SLLIW, Instruction_data(0b0011011, 0x1, 0x00)),
-        Regex_matcher(R"(srliw)", SRLIW, Instruction_data(0b0011011, 0x5, 0x00)),
-        Regex_matcher(R"(sraiw)", SRAIW, Instruction_data(0b0011011, 0x5, 0x20)),
-        Regex_matcher(R"(lwu)", LWU, Instruction_data(0b0000011, 0x6, 0x00)),
-        Regex_matcher(R"(ld)", LD, Instruction_data(0b0000011, 0x3, 0x00)),
-
-        /* S_TYPE */
-        Regex_matcher(R"(sb)", SB, Instruction_data(0b0100011, 0x0, 0x00)),
-        Regex_matcher(R"(sh)", SH, Instruction_data(0b0100011, 0x1, 0x00)),
-        Regex_matcher(R"(sw)", SW, Instruction_data(0b0100011, 0x2, 0x00)),
-        Regex_matcher(R"(lwu)", SD, Instruction_data(0b0100011, 0x3, 0x00)),
-
-        /* B_TYPE */
-        Regex_matcher(R"(beq)", BEQ, Instruction_data(0b1100011, 0x0, 0x00)),
-        Regex_matcher(R"(bne)", BNE, Instruction_data(0b1100011, 0x1, 0x00)),
-        Regex_matcher(R"(blt)", BLT, Instruction_data(0b1100011, 0x4, 0x00)),
-        Regex_matcher(R"(bge)", BGE, Instruction_data(0b1100011, 0x5, 0x00)),
-        Regex_matcher(R"(bltu)", BLTU, Instruction_data(0b1100011, 0x6, 0x00)),
-        Regex_matcher(R"(bgeu)", BGEU, Instruction_data(0b1100011, 0x7, 0x00)),
-
-        /* U_TYPE */
-        Regex_matcher(R"(lui)", LUI, Instruction_data(0b0110111, 0x0, 0x00)),
-        Regex_matcher(R"(auipc)", AUIPC, Instruction_data(0b0010111, 0x0, 0x00)),
-        
-        /* J_TYPE */
-        Regex_matcher(R"(jal)", JAL, Instruction_data(0b1101111, 0x0, 0x00)),
-
-        /* P_TYPE */
-        Regex_matcher(R"(li)", LI, Instruction_data()),
-        Regex_matcher(R"(la)", LA, Instruction_data()),
-        Regex_matcher(R"(mv)", MV, Instruction_data()),
-        Regex_matcher(R"(not)", NOT, Instruction_data()),
-        Regex_matcher(R"(neg)", NEG, Instruction_data()),
-        Regex_matcher(R"(bgt)", BGT, Instruction_data()),
-        Regex_matcher(R"(ble)", BLE, Instruction_data()),
-        Regex_matcher(R"(bgtu)", BGTU, Instruction_data()),
-        Regex_matcher(R"(bleu)", BLEU, Instruction_data()),
-        Regex_matcher(R"(beqz)", BEQZ, Instruction_data()),
-        Regex_matcher(R"(bnez)", BNEZ, Instruction_data()),
-        Regex_matcher(R"(bgez)", BGEZ, Instruction_data()),
-        Regex_matcher(R"(blez)", BLEZ, Instruction_data()),
-        Regex_matcher(R"(bgtz)", BGTZ, Instruction_data()),
-        Regex_matcher(R"(j)", J, Instruction_data()),
-        Regex_matcher(R"(call)", CALL, Instruction_data()),
-        Regex_matcher(R"(ret)", RET, Instruction_data()),
-        Regex_matcher(R"(nop)", NOP, Instruction_data()),
-
-        /* Other */
-        Regex_matcher(R"(0x[0-9a-fA-F]+)", HEX),
-
-        /* REGISTERS */
-        Regex_matcher(R"(x0|zero)", X0, 0),
-        Regex_matcher(R"(x1|ra)", X1, 1),
-        Regex_matcher(R"(x2|sp)", X2, 2),
-        Regex_matcher(R"(x3|gp)", X3, 3),
-        Regex_matcher(R"(x4|tp)", X4, 4),
-        Regex_matcher(R"(x5|t0)", X5, 5),
-        Regex_matcher(R"(x6|t1)", X6, 6),
-        Regex_matcher(R"(x7|t2)", X7, 7),
-        Regex_matcher(R"(x8|s0|fp)", X8, 8),
-        Regex_matcher(R"(x9|s1)", X9, 9),
-        Regex_matcher(R"(x10|a0)", X10, 10),
-        Regex_matcher(R"(x11|a1)", X11, 11),
-        Regex_matcher(R"(x12|a2)", X12, 12),
-        Regex_matcher(R"(x13|a3)", X13, 13),
-        Regex_matcher(R"(x14|a4)", X14, 14),
-        Regex_matcher(R"(x15|a5)", X15, 15),
-        Regex_matcher(R"(x16|a6)", X16, 16),
-        Regex_matcher(R"(x17|a7)", X17, 17),
-        Regex_matcher(R"(x18|s2)", X18, 18),
-        Regex_matcher(R"(x19|s3)", X19, 19),
-        Regex_matcher(R"(x20|s4)", X20, 20),
-        Regex_matcher(R"(x21|s5)", X21, 21),
-        Regex_matcher(R"(x22|s6)", X22, 22),
-        Regex_matcher(R"(x23|s7)", X23, 23),
-        Regex_matcher(R"(x24|s8)", X24, 24),
-        Regex_matcher(R"(x25|s9)", X25, 25),
-        Regex_matcher(R"(x26|s10)", X26, 26),
-        Regex_matcher(R"(x27|s11)", X27, 27),
-        Regex_matcher(R"(x28|t3)", X28, 28),
-        Regex_matcher(R"(x29|t4)", X29, 29),
-        Regex_matcher(R"(x30|t5)", X30, 30),
-        Regex_matcher(R"(x31|t6)", X31, 31),
-
-        /* Other */
-        Regex_matcher(R"(\-?\d+)", INT),
-        Regex_matcher(R"([a-zA-Z_][a-zA-Z0-9_]*:)", LABEL_DEF),
-        Regex_matcher(R"([a-zA-Z_][a-zA-Z0-9_]*)", LABEL_DECL),
-        Regex_matcher(R"(,)", COMMA),
-        Regex_matcher(R"(\.)", DOT),
-        Regex_matcher(R"(#)", COMMENT),
-        Regex_matcher(R"(\()", LBRACK),
-        Regex_matcher(R"(\))", RBRACK),
+    static_assert([] {
+        for(const Keyword_rule& rule : TOKEN_RULES){
+            if(find_keyword(rule.spelling.data(), rule.spelling.size()) != &rule) return false;
+        }
+        return true;
+    }(), "every keyword must hash to its own rule");
+
+    static_assert(find_keyword("addi", 4)->kind == ADDI);
+    static_assert(find_keyword("FP", 2)->payload == 8);
+    static_assert(find_keyword("vle32.v", 7)->payload == VLE32_V);
+    static_assert(find_keyword("V31", 3)->kind == VREG);
+    static_assert(find_keyword("main", 4) == nullptr);
+
+    /*
+        what diagnostics call a token of `kind`
+    */
+    inline std::string token_kind_name(Token_kind kind){
+        for(const Keyword_rule& rule : TOKEN_RULES){
+            if(rule.kind == kind) return "`" + std::string(rule.spelling) + "`";
+        }
+
+        if(kind == COMMA) return "`,`";
+        if(kind == DOT) return "`.`";
+        if(kind == LBRACK) return "`(`";
+        if(kind == RBRACK) return "`)`";
+        if((kind == INT) || (kind == HEX)) return "a number";
+        if((kind == LABEL_DEF) || (kind == LABEL_DECL)) return "a label";
+        if(kind == VREG) return "a vector register";
+        if(kind == COMMENT) return "a comment";
+        if(kind == LINE_END) return "end of line";
+
+        return "end of input";
+    }
+
+    inline Instruction_data find_instr_data_for(Token_kind kind){
+
+        assert(token_is_base_instr(kind) || token_is_pseudo_instr(kind));
+
+        const Instruction_encoding& enc = INSTR_ENCODINGS[kind];
+        return Instruction_data(enc.opcode, enc.funct3, enc.funct7);
+    }
+
+    static_assert(NUM_TOKEN_KINDS <= 256, "token kinds are stored in a byte");
+
+    /*
+        byte range of a token in the source text
+    */
+    struct Span {
+        uint32_t offset = 0;
+        uint32_t length = 0;
     };
 
-    const std::string FULL_REGEX = [] {
-        std::string regex = "(";
+    /*
+        Unpacked copy of one entry of a `Token_stream`. `payload` holds the register number for registers,
+        the symbol id for labels and the literal id for INT/HEX, it is unused for everything else. The span
+        stays in the stream and is looked up through `index` when a diagnostic needs it
+    */
+    struct Token{
+        Token_kind kind = _EOF;
+        uint32_t payload = 0;
+        uint32_t index = 0;
 
-        for (size_t i = 0; i < TOKEN_RULES.size(); i++) {
-            regex += TOKEN_RULES[i].pattern;
+        U32 get_reg_num() const {
+            assert(token_is_reg(kind));
+            return payload;
+        }
 
-            if (i + 1 < TOKEN_RULES.size()) regex += "|";
+        U32 get_vreg_num() const {
+            assert(kind == VREG);
+            return payload;
         }
-        regex += ")";
 
-        return regex;
-    }();
+        Vector_kind get_vector_kind() const {
+            assert(kind == V_INSTR);
+            return (Vector_kind)payload;
+        }
 
-    inline Instruction_data find_instr_data_for(Token_kind kind){
+        Instruction_data get_instr_data() const {
+            return find_instr_data_for(kind);
+        }
 
-        assert(token_is_base_instr(kind));
+        uint32_t get_symbol_id() const {
+            assert((kind == LABEL_DEF) || (kind == LABEL_DECL));
+            return payload;
+        }
 
-        for(size_t i = 0; i < TOKEN_RULES.size(); i++) {
-            if(TOKEN_RULES[i].kind == kind) {
-                return std::get<Instruction_data>(TOKEN_RULES[i].replacement_value.value());
-            }
+        uint32_t get_literal_id() const {
+            assert((kind == INT) || (kind == HEX));
+            return payload;
         }
+    };
+
+    /*
+        Packed structure of arrays token stream: one byte of kind, a 32 bit payload and a source span per token.
+        Label names are interned into symbol ids and numeric literals are parsed once into a side table,
+        so neither needs to be looked at as text again after lexing
+    */
+    class Token_stream {
 
-        return Instruction_data();
-    }
-            
-    class Lexer{
         public:
-            Lexer(){}
+            Token_stream(){}
 
-            Lexer(std::string filename)
-                :_filename(filename)
-            {
-                lex();
+            explicit Token_stream(std::shared_ptr<const Source_file> _source) :
+                source(std::move(_source))
+            {}
+
+            void reserve(size_t n){
+                kinds.reserve(n);
+                payloads.reserve(n);
+                spans.reserve(n);
+            }
+
+            void push(Token_kind kind, uint32_t payload, Span span){
+                kinds.push_back(kind);
+                payloads.push_back(payload);
+                spans.push_back(span);
             }
 
-            inline bool string_is(const std::string& string, const std::string& pattern){
-                bool matches = std::regex_match(string, std::regex(pattern));
-                return ((ignore == false) && matches) || (string == "*/") ;
+            size_t size() const { return kinds.size(); }
+
+            Token operator[](size_t i) const {
+                return Token{(Token_kind)kinds[i], payloads[i], (uint32_t)i};
             }
 
-            inline void lex(){
-                std::string input, matched_string;
-                std::ifstream stream(_filename);
+            Token_kind kind(size_t i) const { return (Token_kind)kinds[i]; }
+
+            uint32_t intern_symbol(std::string_view name){
+                auto [it, inserted] = symbol_ids.try_emplace(name, (uint32_t)symbols.size());
+
+                if(inserted){
+                    symbols.push_back(name);
+                }
+
+                return it->second;
+            }
+
+            uint32_t add_literal(U64 value){
+                literals.push_back(value);
+                return literals.size() - 1;
+            }
+
+            size_t num_symbols() const { return symbols.size(); }
+
+            std::string_view symbol_name(uint32_t id) const { return symbols[id]; }
+
+            U64 literal(uint32_t id) const { return literals[id]; }
+
+            std::string_view source_text() const { return source->text(); }
+
+            std::string_view text(const Token& t) const {
+                const Span& span = spans[t.index];
+                return source->text().substr(span.offset, span.length);
+            }
+
+            /*
+                line:column of `t` in the source, both counted from 1
+            */
+            std::string location(const Token& t) const {
+                std::string_view before = source->text().substr(0, spans[t.index].offset);
+                size_t line_start = before.rfind('\n');
+                size_t column = (line_start == std::string_view::npos) ? before.size() + 1 : before.size() - line_start;
+
+                return std::to_string(std::count(before.begin(), before.end(), '\n') + 1) + ":" + std::to_string(column);
+            }
+
+            /*
+                `t` as diagnostics name it, its text or what it stands for
+            */
+            std::string describe(const Token& t) const {
+                if(t.kind == LINE_END) return "end of line";
+                if(t.kind == _EOF) return "end of input";
+
+                return "`" + std::string(text(t)) + "`";
+            }
+
+            std::string to_string(const Token& t) const {
+                std::string str = std::to_string(t.kind) + " ";
+
+                if(token_is_reg(t.kind)){
+                    str += "x" + std::to_string(t.get_reg_num());
                 
-                std::regex full_pattern(FULL_REGEX, std::regex::icase);
+                } else if (token_is_base_instr(t.kind) || token_is_pseudo_instr(t.kind)){
+                    std::ostringstream data;
+                    data << t.get_instr_data();
+                    str += data.str();
 
-                std::sregex_iterator end;
+                } else if (t.kind == LINE_END){
+                    str += "LINE_END";
 
-                while(std::getline(stream, input)){
+                } else {
+                    str += text(t);
+                }
 
-                    if(input == "") continue;
-                    
-                    std::sregex_iterator begin(input.begin(), input.end(), full_pattern);
+                return str;
+            }
 
-                    for(std::sregex_iterator i = begin; (i != end); ++i){
-                        std::smatch match = *i;
-                        matched_string = match.str();
+            /*
+                Appends the streams in `parts` in order, as if their tokens had been pushed here one by one.
+                Symbols are re-interned in order, the copying and payload remapping runs on `pool`
+            */
+            void append(std::vector<Token_stream>& parts, Thread_pool& pool){
+                std::vector<std::vector<uint32_t>> symbol_remap(parts.size());
+                std::vector<size_t> token_offset(parts.size()), literal_offset(parts.size());
 
-                        if(string_is(matched_string, R"(#)")){
-                            break;
+                size_t n_tokens = size(), n_literals = literals.size();
 
-                        } else if(string_is(matched_string, R"(/\*)")){
-                            ignore = true;
-                            break;
-                        
-                        } else if (string_is(matched_string, R"(\*/)")){
-                            ignore = false;
-                            break;
+                for(size_t i = 0; i < parts.size(); ++i){
+                    for(std::string_view name : parts[i].symbols){
+                        symbol_remap[i].push_back(intern_symbol(name));
+                    }
 
-                        } else {
-                        
-                            for(const Regex_matcher& tr : TOKEN_RULES){
-                                if(string_is(matched_string, tr.pattern)){
-                                    tokens.push_back(Token{tr.replacement_value.value_or(matched_string), tr.kind});                        
+                    token_offset[i] = n_tokens;
+                    literal_offset[i] = n_literals;
 
-                                    break;
-                                }
+                    n_tokens += parts[i].size();
+                    n_literals += parts[i].literals.size();
+                }
+
+                kinds.resize(n_tokens);
+                payloads.resize(n_tokens);
+                spans.resize(n_tokens);
+                literals.resize(n_literals);
+
+                for(size_t i = 0; i < parts.size(); ++i){
+                    pool.submit([&, i]{
+                        const Token_stream& part = parts[i];
+                        size_t base = token_offset[i];
+
+                        std::copy(part.kinds.begin(), part.kinds.end(), kinds.begin() + base);
+                        std::copy(part.spans.begin(), part.spans.end(), spans.begin() + base);
+                        std::copy(part.literals.begin(), part.literals.end(), literals.begin() + literal_offset[i]);
+
+                        for(size_t t = 0; t < part.size(); ++t){
+                            uint32_t payload = part.payloads[t];
+
+                            switch(part.kinds[t]){
+                                case LABEL_DEF: case LABEL_DECL: payload = symbol_remap[i][payload]; break;
+                                case INT: case HEX: payload += literal_offset[i]; break;
+                                default: break;
                             }
+
+                            payloads[base + t] = payload;
                         }
-                    }
+                    });
+                }
+
+                pool.wait();
+            }
+
+            /*
+                bytes held by the token arrays and side tables, not counting the source itself
+            */
+            size_t memory_usage() const {
+                return kinds.capacity() * sizeof(uint8_t) + payloads.capacity() * sizeof(uint32_t) + spans.capacity() * sizeof(Span)
+                    + symbols.capacity() * sizeof(std::string_view) + literals.capacity() * sizeof(U64)
+                    + symbol_ids.size() * (sizeof(std::string_view) + sizeof(uint32_t) + 2 * sizeof(void*));
+            }
+
+        private:
+            std::shared_ptr<const Source_file> source;
+
+            std::vector<uint8_t> kinds;
+            std::vector<uint32_t> payloads;
+            std::vector<Span> spans;
+
+            std::vector<std::string_view> symbols;
+            std::unordered_map<std::string_view, uint32_t> symbol_ids;
+
+            std::vector<U64> literals;
+    };
+
+    class Lexer{
+        public:
+            Lexer(){}
 
-                    tokens.push_back(Token{.value = "LINE_END", .kind = LINE_END});
+            Lexer(std::string filename, size_t threads = 1)
+                :_filename(filename),
+                tokens(std::make_shared<Source_file>(fs::path(filename)))
+            {
+                lex(threads);
+            }
+
+            Lexer(std::shared_ptr<const Source_file> source, size_t threads = 1)
+                :tokens(std::move(source))
+            {
+                lex(threads);
+            }
+
+            /*
+                Inputs of at least `MIN_CHUNK_SIZE` bytes per thread are split and lexed in parallel,
+                the resulting token stream is identical to a serial lex
+            */
+            inline void lex(size_t threads = 1){
+                std::string_view input = tokens.source_text();
+                size_t n_chunks = std::min(threads, input.size() / MIN_CHUNK_SIZE);
+
+                if(n_chunks > 1){
+                    lex_chunked(input, n_chunks);
+                
+                } else {
+                    // rough upper bound on tokens per byte for typical assembly, avoids regrowing the vector
+                    tokens.reserve(input.size() / 3 + 1);
+
+                    scan(input.data(), input.data(), input.data() + input.size(), false, tokens);
                 }
 
-                tokens.push_back(Token{.value = "", .kind = _EOF});        
+                tokens.push(_EOF, 0, Span{(uint32_t)input.size(), 0});
             }
 
             inline void print_tokens() const {
 
                 for(size_t i = 0; i < tokens.size(); ++i){
-                    std::cout << tokens[i] << std::endl;
+                    log_out() << tokens.to_string(tokens[i]) << std::endl;
                 }
             }
 
-            inline std::vector<Token> get_tokens(){
+            inline const Token_stream& get_tokens() const {
                 return tokens;
             }
 
+            /*
+                hand the token stream over to the assembler without copying it
+            */
+            inline Token_stream&& take_tokens(){
+                return std::move(tokens);
+            }
+
+            static constexpr size_t MIN_CHUNK_SIZE = 256 * 1024;
+
         private:
-            std::vector<Token> tokens;
+            /*
+                Splits the input at line boundaries and lexes the chunks on a thread pool. The only lexer state that
+                crosses a line is whether we are inside a block comment. A prescan works out, for every chunk, the
+                state it ends in for both possible starting states, after which the real starting state of every
+                chunk follows from one bool per chunk
+            */
+            inline void lex_chunked(std::string_view input, size_t n_chunks){
+                const char* base = input.data();
+                const char* end = base + input.size();
+
+                std::vector<const char*> bounds = {base};
+
+                for(size_t i = 1; i < n_chunks; ++i){
+                    const char* cut = std::max(base + input.size() * i / n_chunks, bounds.back());
+                    const char* newline = (const char*)memchr(cut, '\n', end - cut);
+
+                    bounds.push_back((newline == nullptr) ? end : newline + 1);
+                }
+
+                bounds.push_back(end);
+
+                Thread_pool pool(n_chunks);
+
+                std::vector<std::array<bool, 2>> exit_state(n_chunks);
+
+                for(size_t i = 0; i < n_chunks; ++i){
+                    pool.submit([&, i]{
+                        exit_state[i][0] = in_block_comment_after(bounds[i], bounds[i + 1], false);
+                        exit_state[i][1] = in_block_comment_after(bounds[i], bounds[i + 1], true);
+                    });
+                }
+
+                pool.wait();
+
+                std::vector<Token_stream> parts(n_chunks);
+                bool in_comment = false;
+
+                for(size_t i = 0; i < n_chunks; ++i){
+                    pool.submit([&, i, in_comment]{
+                        parts[i].reserve((bounds[i + 1] - bounds[i]) / 3 + 1);
+                        scan(base, bounds[i], bounds[i + 1], in_comment, parts[i]);
+                    });
+
+                    in_comment = exit_state[i][in_comment];
+                }
+
+                pool.wait();
+
+                tokens.append(parts, pool);
+            }
+
+            /*
+                block comment state at `end` when starting at the beginning of a line in state `in_comment`,
+                must agree with `scan` on where comments start and end
+            */
+            static bool in_block_comment_after(const char* p, const char* end, bool in_comment){
+
+                if(memmem(p, end - p, "/*", 2) == nullptr){
+                    // nothing can open a comment, so the state only changes if we start in one that ends here
+                    return in_comment && (memmem(p, end - p, "*/", 2) == nullptr);
+                }
+
+                while(p < end){
+                    if(in_comment){
+                        if((*p == '*') && (p + 1 < end) && (p[1] == '/')){
+                            in_comment = false;
+                            p += 2;
+                        } else {
+                            p++;
+                        }
+
+                    } else if (*p == '#'){
+                        const char* newline = (const char*)memchr(p, '\n', end - p);
+                        p = (newline == nullptr) ? end : newline;
+
+                    } else if ((*p == '/') && (p + 1 < end) && (p[1] == '*')){
+                        in_comment = true;
+                        p += 2;
+                    
+                    } else {
+                        p++;
+                    }
+                }
+
+                return in_comment;
+            }
+
+            /*
+                Single pass scanner. Every byte is classified once through `CHAR_CLASSES`, words are always
+                scanned to their full length before being looked up, so `addi` never lexes as `add`
+
+                Empty lines produce no tokens, every other line ends in a LINE_END token. `begin` must be the
+                start of a line, spans are relative to `base`
+
+                Label and literal tokens only record their span in the mapped source, nothing is copied
+            */
+            static void scan(const char* base, const char* begin, const char* end, bool ignore, Token_stream& tokens){
+                const char* p = begin;
+                const char* line_start = p;
+
+                while(p < end){
+                    const char* tok_start = p;
+
+                    if(ignore){
+                        // inside a block comment, only look for the end of it
+                        if((*p == '*') && (p + 1 < end) && (p[1] == '/')){
+                            ignore = false;
+                            p += 2;
+                            continue;
+                        } else if (*p != '\n'){
+                            p++;
+                            continue;
+                        }
+                    }
+
+                    switch(CHAR_CLASSES[(unsigned char)*p]){
+                        case CC_NEWLINE:
+                            if(p != line_start){
+                                tokens.push(LINE_END, 0, span_of(base, p, p + 1));
+                            }
+
+                            line_start = ++p;
+                            break;
+
+                        case CC_IDENT_START: {
+                            while((++p < end) && is_ident_char(*p));
+
+                            if((p < end) && (*p == ':')){
+                                tokens.push(LABEL_DEF, tokens.intern_symbol(std::string_view(tok_start, p - tok_start)), span_of(base, tok_start, p));
+                                p++;
+
+                            } else if (const Keyword_rule* rule = find_keyword(tok_start, p - tok_start)){
+                                tokens.push(rule->kind, rule->payload, span_of(base, tok_start, p));
+
+                            } else {
+                                tokens.push(LABEL_DECL, tokens.intern_symbol(std::string_view(tok_start, p - tok_start)), span_of(base, tok_start, p));
+                            }
+
+                            break;
+                        }
+
+                        case CC_MINUS:
+                            if((p + 1 == end) || (CHAR_CLASSES[(unsigned char)p[1]] != CC_DIGIT)){
+                                p++;
+                                break;
+                            }
+
+                            p++;
+                            [[fallthrough]];
+
+                        case CC_DIGIT:
+                            if((*p == '0') && (p + 2 < end) && ((p[1] | 0x20) == 'x') && is_hex_digit(p[2]) && (*tok_start != '-')){
+                                p += 2;
+                                while((p < end) && is_hex_digit(*p)) p++;
+
+                                push_literal(tokens, HEX, base, tok_start, p);
+                            
+                            } else {
+                                while((p < end) && (CHAR_CLASSES[(unsigned char)*p] == CC_DIGIT)) p++;
+
+                                push_literal(tokens, INT, base, tok_start, p);
+                            }
+
+                            break;
+
+                        case CC_COMMA: tokens.push(COMMA, 0, span_of(base, p, p + 1)); p++; break;
+                        case CC_DOT: tokens.push(DOT, 0, span_of(base, p, p + 1)); p++; break;
+                        case CC_LBRACK: tokens.push(LBRACK, 0, span_of(base, p, p + 1)); p++; break;
+                        case CC_RBRACK: tokens.push(RBRACK, 0, span_of(base, p, p + 1)); p++; break;
+
+                        case CC_HASH:
+                            // line comment, skip to the newline
+                            while((p < end) && (*p != '\n')) p++;
+                            break;
+
+                        case CC_SLASH:
+                            if((p + 1 < end) && (p[1] == '*')){
+                                ignore = true;
+                                p += 2;
+                            } else {
+                                p++;
+                            }
+                            break;
+
+                        case CC_OTHER:
+                        case CC_SPACE:
+                        case CC_COLON:
+                            p++;
+                            break;
+                    }
+                }
+
+                if(p != line_start){
+                    tokens.push(LINE_END, 0, span_of(base, p, p));
+                }
+            }
+
+            static Span span_of(const char* base, const char* start, const char* end){
+                return Span{(uint32_t)(start - base), (uint32_t)(end - start)};
+            }
+
+            static void push_literal(Token_stream& tokens, Token_kind kind, const char* base, const char* start, const char* end){
+                U64 value = parse_int(std::string_view(start, end - start));
+                tokens.push(kind, tokens.add_literal(value), span_of(base, start, end));
+            }
+
             std::string _filename = ""; 
-            bool ignore = false;
+            Token_stream tokens;
             
     };
 
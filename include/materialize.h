@@ -0,0 +1,365 @@
+#pragma once
+
+#include <bit>
+#include "encoder.h"
+
+namespace Assembler {
+
+    /*
+        Instruction sequences that load a 64 bit constant into a register, what `li` expands to. The
+        search follows the one LLVM uses: build the constant from its upper bits down with lui, addiw,
+        slli and addi, then try every shorter shape there is, like shifting out trailing or leading zeros,
+        inverting, or one of the bit manipulation instructions, and keep the shortest
+    */
+
+    /*
+        bit manipulation extensions a sequence may use, as a bit set
+    */
+    enum Bitmanip_extension : uint8_t {
+        EXT_ZBA = 1 << 0,
+        EXT_ZBB = 1 << 1,
+        EXT_ZBS = 1 << 2,
+        EXT_BITMANIP = EXT_ZBA | EXT_ZBB | EXT_ZBS,
+    };
+
+    struct Li_step {
+        // a `Token_kind`, kinds fit in a byte
+        uint8_t kind;
+        // full value for lui, shift amount or bit number for the shifts and bit instructions, 0 for sh*add and add.uw
+        int32_t imm;
+    };
+
+    /*
+        The first step reads zero and every other one the result of the step before it: add.uw adds it to
+        zero, sh1add, sh2add and sh3add add it to itself. No constant needs more than 8 steps
+    */
+    struct Li_sequence {
+        std::array<Li_step, 8> steps{};
+        uint8_t size = 0;
+
+        constexpr void push(Token_kind kind, int64_t imm){
+            steps[size++] = Li_step{(uint8_t)kind, (int32_t)imm};
+        }
+    };
+
+    namespace detail {
+
+        constexpr bool fits_signed(int64_t value, int bits){
+            return (value >= -(INT64_C(1) << (bits - 1))) && (value < (INT64_C(1) << (bits - 1)));
+        }
+
+        constexpr bool fits_unsigned_32(U64 value){
+            return (value >> 32) == 0;
+        }
+
+        constexpr int64_t low_12(int64_t value){
+            return (int64_t)((U64)value << 52) >> 52;
+        }
+
+        /*
+            lui and addiw for 32 bit values, otherwise the constant without its lower 12 bits and its
+            trailing zeros, followed by slli and addi
+        */
+        constexpr void li_from_upper_bits(int64_t value, uint8_t extensions, Li_sequence& sequence){
+
+            // a single bit that lui or addi can't set
+            if((extensions & EXT_ZBS) && std::has_single_bit((U64)value) && (!fits_signed(value, 32) || (value == 0x800))){
+                sequence.push(BSETI, std::countr_zero((U64)value));
+                return;
+            }
+
+            if(fits_signed(value, 32)){
+                int64_t hi20 = ((value + 0x800) >> 12) & 0xfffff;
+                int64_t lo12 = low_12(value);
+
+                if(hi20){
+                    sequence.push(LUI, (int32_t)(U32)(hi20 << 12));
+                }
+
+                // addiw keeps lui + addi from carrying into bit 32
+                if(lo12 || (hi20 == 0)){
+                    sequence.push(hi20 ? ADDIW : ADDI, lo12);
+                }
+
+                return;
+            }
+
+            /*
+                addi sign extends, so the lower 12 bits are taken off first and the rest is built before
+                them: lower bits first, instructions last
+            */
+            int64_t lo12 = low_12(value);
+            value = (U64)value - (U64)lo12;
+
+            int shift = 0;
+            bool unsigned_32 = false;
+
+            if(!fits_signed(value, 32)){
+                shift = std::countr_zero((U64)value);
+                value = value >> shift;
+
+                // 12 zeros less to shift in is a value lui can load
+                if((shift > 12) && !fits_signed(value, 12)){
+                    if(fits_signed((int64_t)((U64)value << 12), 32)){
+                        shift -= 12;
+                        value = (int64_t)((U64)value << 12);
+
+                    } else if (fits_unsigned_32((U64)value << 12) && (extensions & EXT_ZBA)){
+                        // slli.uw clears the upper bits lui sets
+                        shift -= 12;
+                        value = (int64_t)(((U64)value << 12) | (0xffffffffull << 32));
+                        unsigned_32 = true;
+                    }
+                }
+
+                if(fits_unsigned_32((U64)value) && !fits_signed(value, 32) && (extensions & EXT_ZBA)){
+                    value = (int64_t)((U64)value | (0xffffffffull << 32));
+                    unsigned_32 = true;
+                }
+            }
+
+            li_from_upper_bits(value, extensions, sequence);
+
+            if(shift){
+                sequence.push(unsigned_32 ? SLLI_UW : SLLI, shift);
+            }
+
+            if(lo12){
+                sequence.push(ADDI, lo12);
+            }
+        }
+
+        /*
+            a positive `value` shifted all the way up and shifted back down with srli at the end, with ones
+            or zeros shifted in, and with 32 leading zeros and Zba with ones on top cleared by add.uw.
+            Replaces `sequence` if that is shorter
+        */
+        constexpr void li_from_leading_zeros(int64_t value, uint8_t extensions, Li_sequence& sequence){
+            int leading_zeros = std::countl_zero((U64)value);
+            U64 shifted = ((U64)value << leading_zeros) | ((1ull << leading_zeros) - 1);
+
+            auto keep_if_shorter = [&](U64 candidate, Token_kind last, int32_t imm){
+                Li_sequence other;
+                li_from_upper_bits(candidate, extensions, other);
+
+                if((other.size + 1 < sequence.size) || ((sequence.size == 0) && (other.size < 8))){
+                    other.push(last, imm);
+                    sequence = other;
+                }
+            };
+
+            keep_if_shorter(shifted, SRLI, leading_zeros);
+            keep_if_shorter(shifted & ~((1ull << leading_zeros) - 1), SRLI, leading_zeros);
+
+            if((leading_zeros == 32) && (extensions & EXT_ZBA)){
+                keep_if_shorter((U64)value | (0xffffffffull << 32), ADD_UW, 0);
+            }
+        }
+
+        /*
+            rotate amount that turns `value` into a 12 bit immediate, 0 if there is none
+        */
+        constexpr int li_rotate_amount(int64_t value){
+            int leading_ones = std::countl_one((U64)value);
+            int trailing_ones = std::countr_one((U64)value);
+
+            // 0b11..1xxxxx1..1
+            if((trailing_ones > 0) && (trailing_ones < 64) && (leading_ones + trailing_ones > 64 - 12)){
+                return 64 - trailing_ones;
+            }
+
+            // 0bxxx1..1..1xxx, the ones crossing bit 32
+            int upper_trailing_ones = std::countr_one((U32)((U64)value >> 32));
+            int lower_leading_ones = std::countl_one((U32)value);
+
+            if((upper_trailing_ones < 32) && (upper_trailing_ones + lower_leading_ones > 64 - 12)){
+                return 32 - upper_trailing_ones;
+            }
+
+            return 0;
+        }
+
+    }
+
+    /*
+        shortest sequence found for `value`, using the instructions of `extensions` where they help
+    */
+    constexpr Li_sequence li_sequence(int64_t value, uint8_t extensions = 0){
+        Li_sequence best;
+        detail::li_from_upper_bits(value, extensions, best);
+
+        auto is_shorter = [&](const Li_sequence& candidate, int extra){
+            return candidate.size + extra < best.size;
+        };
+
+        // trailing zeros shifted in at the end, if that is shorter or ends up as c.li + c.slli
+        if(((value & 0xfff) != 0) && ((value & 1) == 0) && (best.size >= 2)){
+            int trailing_zeros = std::countr_zero((U64)value);
+            int64_t shifted = value >> trailing_zeros;
+
+            Li_sequence other;
+            detail::li_from_upper_bits(shifted, extensions, other);
+
+            if(is_shorter(other, 1) || detail::fits_signed(shifted, 6)){
+                other.push(SLLI, trailing_zeros);
+                best = other;
+            }
+        }
+
+        // lui + addiw is as short as it gets
+        if(best.size <= 2){
+            return best;
+        }
+
+        // lower bits like 0x17ff become 0x1800 and more trailing zeros, an addi -1 at the end undoes that
+        if(((value & 0xfff) != 0) && ((value & 0x1800) == 0x1000)){
+            int64_t imm = -(0x800 - (value & 0xfff));
+
+            Li_sequence other;
+            detail::li_from_upper_bits(value - imm, extensions, other);
+
+            if(is_shorter(other, 1)){
+                other.push(ADDI, imm);
+                best = other;
+            }
+        }
+
+        if((value > 0) && (best.size > 2)){
+            detail::li_from_leading_zeros(value, extensions, best);
+        }
+
+        // the inverse, flipped back with xori -1
+        if((value < 0) && (best.size > 3)){
+            Li_sequence other;
+            detail::li_from_leading_zeros(~value, extensions, other);
+
+            if((other.size > 0) && is_shorter(other, 1)){
+                other.push(XORI, -1);
+                best = other;
+            }
+        }
+
+        if((extensions & EXT_ZBS) && (best.size > 2)){
+            // the lower 31 bits with lui + addiw and every upper bit that is set by bseti
+            U64 lo = value & 0x7fffffff;
+            U64 hi = value ^ lo;
+
+            Li_sequence other;
+
+            if(lo != 0){
+                detail::li_from_upper_bits(lo, extensions, other);
+            }
+
+            if(is_shorter(other, std::popcount(hi))){
+                for(; hi != 0; hi &= hi - 1){
+                    other.push(BSETI, std::countr_zero(hi));
+                }
+
+                best = other;
+            }
+        }
+
+        if((extensions & EXT_ZBS) && (best.size > 2)){
+            // the lower 31 bits sign extended from ones and every upper bit that is clear by bclri
+            U64 lo = value | 0xffffffff80000000ull;
+            U64 hi = value ^ lo;
+
+            Li_sequence other;
+            detail::li_from_upper_bits(lo, extensions, other);
+
+            if(is_shorter(other, std::popcount(hi))){
+                for(; hi != 0; hi &= hi - 1){
+                    other.push(BCLRI, std::countr_zero(hi));
+                }
+
+                best = other;
+            }
+        }
+
+        if((extensions & EXT_ZBA) && (best.size > 2)){
+            // a 32 bit value times 3, 5 or 9 is sh1add, sh2add or sh3add of it with itself
+            constexpr std::array<std::pair<int64_t, Token_kind>, 3> MULTIPLIERS = {{{3, SH1ADD}, {5, SH2ADD}, {9, SH3ADD}}};
+
+            int64_t hi52 = (int64_t)(((U64)value + 0x800) & ~0xfffull);
+            int64_t lo12 = detail::low_12(value);
+
+            for(auto [multiplier, kind] : MULTIPLIERS){
+                if(((value % multiplier) == 0) && detail::fits_signed(value / multiplier, 32)){
+                    Li_sequence other;
+                    detail::li_from_upper_bits(value / multiplier, extensions, other);
+
+                    if(is_shorter(other, 1)){
+                        other.push(kind, 0);
+                        best = other;
+                    }
+                }
+            }
+
+            // the same for the upper 52 bits, followed by the addi of the lower 12
+            for(auto [multiplier, kind] : MULTIPLIERS){
+                if((lo12 != 0) && ((hi52 % multiplier) == 0) && detail::fits_signed(hi52 / multiplier, 32)){
+                    Li_sequence other;
+                    detail::li_from_upper_bits(hi52 / multiplier, extensions, other);
+
+                    if(is_shorter(other, 2)){
+                        other.push(kind, 0);
+                        other.push(ADDI, lo12);
+                        best = other;
+                    }
+                }
+            }
+        }
+
+        // a 12 bit immediate rotated into place
+        if((extensions & EXT_ZBB) && (best.size > 2)){
+            if(int rotate = detail::li_rotate_amount(value)){
+                best = Li_sequence{};
+                best.push(ADDI, (int64_t)std::rotl((U64)value, rotate));
+                best.push(RORI, rotate);
+            }
+        }
+
+        return best;
+    }
+
+    /*
+        what `sequence` leaves in its register
+    */
+    constexpr U64 li_value(const Li_sequence& sequence){
+        U64 value = 0;
+
+        for(uint8_t i = 0; i < sequence.size; ++i){
+            const Li_step& step = sequence.steps[i];
+            U64 imm = (U64)(int64_t)step.imm;
+
+            switch(step.kind){
+                case LUI: value = imm; break;
+                case ADDI: value += imm; break;
+                case ADDIW: value = (U64)(int64_t)(int32_t)(U32)(value + imm); break;
+                case XORI: value ^= imm; break;
+                case SLLI: value <<= imm; break;
+                case SRLI: value >>= imm; break;
+                case SLLI_UW: value = (U64)(U32)value << imm; break;
+                case ADD_UW: value = (U32)value; break;
+                case SH1ADD: value += value << 1; break;
+                case SH2ADD: value += value << 2; break;
+                case SH3ADD: value += value << 3; break;
+                case BSETI: value |= 1ull << imm; break;
+                case BCLRI: value &= ~(1ull << imm); break;
+                case RORI: value = std::rotr(value, (int)imm); break;
+                default: return ~value;
+            }
+        }
+
+        return value;
+    }
+
+    static_assert(li_sequence(-1).size == 1 && li_value(li_sequence(-1)) == ~0ull);
+    static_assert(li_sequence(0x7fffffff).size == 2 && li_sequence(0x7fffffff).steps[1].kind == ADDIW, "lui + addi would carry into bit 32");
+    static_assert(li_sequence(0xffffffff).size == 2 && li_sequence(0xffffffff).steps[1].kind == SRLI, "addi -1, srli 32");
+    static_assert(li_sequence(0x1234567887654321).size == 8 && li_value(li_sequence(0x1234567887654321)) == 0x1234567887654321);
+    static_assert(li_sequence(0x8000000000000000).size == 2 && li_sequence(0x8000000000000000, EXT_ZBS).size == 1);
+    static_assert(li_sequence(0xfffffffffff800ff, EXT_ZBB).size == 2 && li_value(li_sequence(0xfffffffffff800ff, EXT_ZBB)) == 0xfffffffffff800ff);
+    static_assert(li_value(li_sequence(0x555555555, EXT_BITMANIP)) == 0x555555555);
+
+}
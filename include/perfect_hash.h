@@ -0,0 +1,139 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <stdexcept>
+
+namespace Assembler {
+
+    /*
+        case insensitive FNV-1a, the part of a keyword hash that reads the key
+    */
+    constexpr uint32_t keyword_fnv(std::string_view key){
+        uint32_t h = 2166136261u;
+
+        for(char c : key){
+            h ^= (uint8_t)(c | 0x20);
+            h *= 16777619u;
+        }
+
+        return h;
+    }
+
+    /*
+        murmur finaliser over the FNV-1a of a key, `seed` selects a different member of the hash family. The
+        seed goes in after the key, so every member reuses the one pass over the key
+    */
+    constexpr uint32_t keyword_hash(uint32_t fnv, uint32_t seed){
+        uint32_t h = fnv ^ (seed * 0x9e3779b9u);
+
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35u;
+        h ^= h >> 16;
+
+        return h;
+    }
+
+    constexpr bool keyword_equals(std::string_view keyword, const char* text, size_t len){
+        if(keyword.size() != len) return false;
+
+        for(size_t i = 0; i < len; ++i){
+            char c = text[i];
+            if((c >= 'A') && (c <= 'Z')) c |= 0x20;
+
+            if(c != keyword[i]) return false;
+        }
+
+        return true;
+    }
+
+    constexpr size_t next_pow2(size_t n){
+        size_t p = 1;
+        while(p < n) p <<= 1;
+        return p;
+    }
+
+    /*
+        Hash and displace perfect hash over a fixed key set. Keys are first spread over buckets with seed 0, then
+        every bucket gets the smallest seed that places all of its keys into free slots. A lookup is one pass
+        over the key, two finalisers, one table index and one string compare
+    */
+    template<size_t N_KEYS>
+    struct Perfect_hash {
+        static constexpr size_t N_SLOTS = next_pow2(2 * N_KEYS);
+        static constexpr size_t N_BUCKETS = N_SLOTS / 4;
+
+        std::array<uint16_t, N_BUCKETS> displacement{};
+
+        // key index + 1, 0 marks an empty slot
+        std::array<uint16_t, N_SLOTS> slots{};
+
+        constexpr explicit Perfect_hash(const std::array<std::string_view, N_KEYS>& keys){
+            std::array<uint32_t, N_KEYS> fnv{};
+            std::array<uint16_t, N_KEYS> bucket_of{};
+            std::array<uint16_t, N_BUCKETS> bucket_size{};
+
+            for(size_t i = 0; i < N_KEYS; ++i){
+                fnv[i] = keyword_fnv(keys[i]);
+                bucket_of[i] = keyword_hash(fnv[i], 0) & (N_BUCKETS - 1);
+                bucket_size[bucket_of[i]]++;
+            }
+
+            // place the largest buckets first, they are the hardest to fit
+            std::array<uint16_t, N_BUCKETS> order{};
+            for(size_t b = 0; b < N_BUCKETS; ++b) order[b] = b;
+
+            for(size_t i = 0; i < N_BUCKETS; ++i){
+                for(size_t j = i + 1; j < N_BUCKETS; ++j){
+                    if(bucket_size[order[j]] > bucket_size[order[i]]){
+                        uint16_t tmp = order[i]; order[i] = order[j]; order[j] = tmp;
+                    }
+                }
+            }
+
+            for(uint16_t b : order){
+                if(bucket_size[b] == 0) break;
+
+                bool placed = false;
+
+                for(uint32_t seed = 1; (seed < 0xffff) && !placed; ++seed){
+                    std::array<uint16_t, N_SLOTS> trial = slots;
+                    placed = true;
+
+                    for(size_t i = 0; i < N_KEYS; ++i){
+                        if(bucket_of[i] != b) continue;
+
+                        uint32_t slot = keyword_hash(fnv[i], seed) & (N_SLOTS - 1);
+
+                        if(trial[slot] != 0){
+                            placed = false;
+                            break;
+                        }
+
+                        trial[slot] = i + 1;
+                    }
+
+                    if(placed){
+                        slots = trial;
+                        displacement[b] = seed;
+                    }
+                }
+
+                if(!placed) throw std::logic_error("no perfect hash for key set");
+            }
+        }
+
+        /*
+            slot candidate for `key`, the caller must still compare against the stored key
+        */
+        constexpr int find(std::string_view key) const {
+            uint32_t fnv = keyword_fnv(key);
+            uint32_t seed = displacement[keyword_hash(fnv, 0) & (N_BUCKETS - 1)];
+            return (int)slots[keyword_hash(fnv, seed) & (N_SLOTS - 1)] - 1;
+        }
+    };
+
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include "api.h"
+#include "thread_pool.h"
+
+namespace Assembler {
+
+    /*
+        Framing of the --serve protocol, every integer is a little endian uint32_t
+
+        request:   length, `length` bytes of source
+        response:  ok (0 or 1), number of code words, number of data ranges, diagnostics length, the code words,
+                   the data ranges, the diagnostics
+
+        A data range is the index of its first word and the index after its last. Those words are literal pool
+        numbers (`Result::data`), always 4 bytes, the others are instructions, 2 bytes with `--compress` when
+        their lowest two bits aren't 0b11.
+
+        A connection carries any number of requests, answered in order. The connection ends when the client
+        closes it, or after a request larger than `MAX_REQUEST_SIZE`, which is answered with an error first
+    */
+    inline constexpr uint32_t MAX_REQUEST_SIZE = 256u << 20;
+
+    inline bool read_exact(int fd, char* data, size_t size){
+        while(size > 0){
+            ssize_t n = ::read(fd, data, size);
+
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return false;
+
+            data += n;
+            size -= n;
+        }
+
+        return true;
+    }
+
+    inline bool write_all(int fd, const char* data, size_t size){
+        while(size > 0){
+            ssize_t n = ::write(fd, data, size);
+
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return false;
+
+            data += n;
+            size -= n;
+        }
+
+        return true;
+    }
+
+    inline void put_u32(std::string& buffer, uint32_t value){
+        for(int byte = 0; byte < 4; ++byte){
+            buffer += (char)((value >> (8 * byte)) & 0xff);
+        }
+    }
+
+    inline uint32_t get_u32(const char* data){
+        const unsigned char* bytes = (const unsigned char*)data;
+        return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    }
+
+    inline std::string encode_response(const Result& result){
+        std::string buffer;
+        buffer.reserve(16 + result.code.size() * 4 + result.data.size() * 8 + result.diagnostics.size());
+
+        put_u32(buffer, result.ok);
+        put_u32(buffer, result.code.size());
+        put_u32(buffer, result.data.size());
+        put_u32(buffer, result.diagnostics.size());
+
+        for(U32 word : result.code){
+            put_u32(buffer, word);
+        }
+
+        for(const Data_range& range : result.data){
+            put_u32(buffer, range.begin);
+            put_u32(buffer, range.end);
+        }
+
+        buffer += result.diagnostics;
+
+        return buffer;
+    }
+
+    /*
+        answer requests from `in_fd` on `out_fd` with `options` until the input ends or fails
+    */
+    inline void serve_connection(int in_fd, int out_fd, const Options& options){
+        std::string source;
+        char header[4];
+
+        while(read_exact(in_fd, header, 4)){
+            uint32_t length = get_u32(header);
+
+            if(length > MAX_REQUEST_SIZE){
+                Result result;
+                result.diagnostics = "Request of " + std::to_string(length) + " bytes is larger than the limit of " + std::to_string(MAX_REQUEST_SIZE);
+
+                std::string response = encode_response(result);
+                write_all(out_fd, response.data(), response.size());
+                return;
+            }
+
+            source.resize(length);
+
+            if(!read_exact(in_fd, source.data(), length)){
+                return;
+            }
+
+            std::string response = encode_response(assemble(source, options));
+
+            if(!write_all(out_fd, response.data(), response.size())){
+                return;
+            }
+        }
+    }
+
+    /*
+        Serves stdin/stdout when `socket_path` is empty, otherwise listens on a Unix socket at `socket_path`
+        and serves every client on its own task of a pool of `jobs` threads, so up to `jobs` clients are
+        answered at the same time. Every request is assembled with `options`. Only returns on an error
+    */
+    inline int serve(const std::string& socket_path, size_t jobs, const Options& options){
+        // a client going away must not kill the server
+        signal(SIGPIPE, SIG_IGN);
+
+        if(socket_path.empty()){
+            serve_connection(STDIN_FILENO, STDOUT_FILENO, options);
+            return 0;
+        }
+
+        sockaddr_un address {};
+        address.sun_family = AF_UNIX;
+
+        if(socket_path.size() >= sizeof(address.sun_path)){
+            ERROR("Socket path " + socket_path + " is too long");
+            return 1;
+        }
+
+        std::strcpy(address.sun_path, socket_path.c_str());
+
+        int listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+        ::unlink(socket_path.c_str());
+
+        if((listen_fd < 0) || (::bind(listen_fd, (sockaddr*)&address, sizeof(address)) != 0) || (::listen(listen_fd, 64) != 0)){
+            ERROR("Cannot listen on " + socket_path + ": " + std::strerror(errno));
+            return 1;
+        }
+
+        INFO("Serving on " << socket_path);
+
+        Thread_pool pool(jobs);
+
+        while(true){
+            int client = ::accept(listen_fd, nullptr, nullptr);
+
+            if(client < 0){
+                if(errno == EINTR) continue;
+
+                ERROR(std::string("accept failed: ") + std::strerror(errno));
+                break;
+            }
+
+            pool.submit([client, &options]{
+                serve_connection(client, client, options);
+                ::close(client);
+            });
+        }
+
+        ::close(listen_fd);
+        pool.wait();
+
+        return 1;
+    }
+
+}
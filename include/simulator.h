@@ -0,0 +1,476 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "disassembler.h"
+
+namespace Assembler {
+
+    struct Sim_options {
+        // stop after this many instructions, 0 for no limit
+        U64 max_instructions = 100'000'000;
+        // bytes of zeroed memory from address 0, the code image is copied to its start
+        size_t memory_size = 16u << 20;
+    };
+
+    enum Sim_exit {
+        SIM_END,                // ran past the last instruction, or returned to the initial ra
+        SIM_SELF_LOOP,          // reached a jump to itself, the usual way to park a program
+        SIM_LIMIT,              // ran `max_instructions`
+        SIM_BAD_JUMP,           // jumped outside the program or to an address that isn't 4 byte aligned
+        SIM_BAD_ACCESS,         // load or store outside memory
+        SIM_BAD_INSTRUCTION,    // a word that is not an instruction this assembler knows
+    };
+
+    inline const char* to_string(Sim_exit exit){
+        switch(exit){
+            case SIM_END: return "end of program";
+            case SIM_SELF_LOOP: return "jump to itself";
+            case SIM_LIMIT: return "instruction limit";
+            case SIM_BAD_JUMP: return "jump outside the program";
+            case SIM_BAD_ACCESS: return "memory access outside memory";
+            case SIM_BAD_INSTRUCTION: return "unknown instruction";
+        }
+
+        return "";
+    }
+
+    struct Sim_result {
+        Sim_exit exit = SIM_END;
+        // of the instruction that stopped the program, or where it ended up
+        U64 pc = 0;
+        U64 instructions = 0;
+        std::array<U64, 32> regs{};
+
+        bool trapped() const { return exit >= SIM_BAD_JUMP; }
+    };
+
+    /*
+        register dump, one register per line with its ABI name, in hex and as a signed number
+    */
+    inline void print_registers(std::ostream& out, const Sim_result& result){
+        char line[96];
+
+        std::snprintf(line, sizeof(line), "stopped: %s at pc 0x%llx after %llu instructions\n", to_string(result.exit), (unsigned long long)result.pc, (unsigned long long)result.instructions);
+        out << line;
+
+        for(int r = 0; r < 32; ++r){
+            std::snprintf(line, sizeof(line), "x%-2d %-4s 0x%016llx %lld\n", r, REGISTER_NAMES[r], (unsigned long long)result.regs[r], (long long)result.regs[r]);
+            out << line;
+        }
+    }
+
+    /*
+        RV64M division doesn't trap: dividing by zero gives all ones and leaves the dividend as the remainder,
+        the one signed division that overflows gives the dividend and a remainder of 0
+    */
+    template<typename T>
+    constexpr T sim_div(T a, T b){
+        if(b == 0) return (T)-1;
+        if(std::is_signed_v<T> && (a == std::numeric_limits<T>::min()) && (b == (T)-1)) return a;
+        return a / b;
+    }
+
+    template<typename T>
+    constexpr T sim_rem(T a, T b){
+        if(b == 0) return a;
+        if(std::is_signed_v<T> && (a == std::numeric_limits<T>::min()) && (b == (T)-1)) return 0;
+        return a % b;
+    }
+
+    static_assert(sim_div<int64_t>(INT64_MIN, -1) == INT64_MIN && sim_rem<int64_t>(INT64_MIN, -1) == 0);
+    static_assert(sim_div<U32>(7, 0) == 0xffffffff && sim_rem<int32_t>(-7, 0) == -7);
+    static_assert(sim_div<int32_t>(-7, 2) == -3 && sim_rem<int32_t>(-7, 2) == -1);
+
+    /*
+        orc.b, every byte that isn't zero becomes 0xff
+    */
+    constexpr U64 sim_orc_b(U64 a){
+        U64 low = a & 0x7f7f7f7f7f7f7f7full;
+        U64 set = ((low + 0x7f7f7f7f7f7f7f7full) | a) & 0x8080808080808080ull;
+
+        return (set >> 7) * 0xff;
+    }
+
+    static_assert(sim_orc_b(0x0001008000ff0200ull) == 0x00ff00ff00ffff00ull);
+
+    /*
+        Runs an assembled image on an RV64IM hart with Zba, Zbb and Zbs. The code is predecoded once into one
+        record per instruction, holding the address of its handler in `run`, so every handler ends in a jump
+        straight to the next one (threaded code) instead of going back through a dispatch loop. Branch
+        targets, return addresses and auipc results are worked out while predecoding.
+
+        Writes to x0 go to a 33rd register nothing reads, so no handler has to check rd. The image is also
+        copied to the start of memory, but the predecoded code is what runs: stores there change data,
+        never instructions. sp starts at the top of memory and ra at the end of the program, so returning
+        from the entry point ends the run
+    */
+    class Simulator {
+
+        public:
+            Simulator(const std::vector<U32>& _code, const Sim_options& _options = {}) :
+                code(_code),
+                options(_options)
+            {
+                if((code.size() * 4 > options.memory_size) || (options.memory_size < 8)){
+                    PANIC("Program of " + std::to_string(code.size() * 4) + " bytes does not fit in " + std::to_string(options.memory_size) + " bytes of memory");
+                }
+
+                // zero pages are only backed once they are touched
+                void* addr = mmap(nullptr, options.memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+                if(addr == MAP_FAILED){
+                    PANIC("Cannot map " + std::to_string(options.memory_size) + " bytes of simulator memory");
+                }
+
+                memory = (uint8_t*)addr;
+                std::memcpy(memory, code.data(), code.size() * 4);
+            }
+
+            Simulator(const Simulator&) = delete;
+            Simulator& operator=(const Simulator&) = delete;
+
+            ~Simulator(){
+                munmap(memory, options.memory_size);
+            }
+
+            Sim_result run(){
+                /*
+                    handler of every kind, labels of this function so they can be jumped to directly
+                */
+                std::array<const void*, NUM_TOKEN_KINDS> handlers{};
+                handlers.fill(&&bad_instruction);
+
+                #define SIM_HANDLER(kind) handlers[kind] = &&op_##kind;
+                #define R_TYPE(kind, ...) SIM_HANDLER(kind)
+                #define I_TYPE(kind, ...) SIM_HANDLER(kind)
+                #define S_TYPE(kind, ...) SIM_HANDLER(kind)
+                #define B_TYPE(kind, ...) SIM_HANDLER(kind)
+                #define U_TYPE(kind, ...) SIM_HANDLER(kind)
+                #define J_TYPE(kind, ...) SIM_HANDLER(kind)
+                #define UNARY(kind, ...) SIM_HANDLER(kind)
+                #include "instructions.def"
+                #undef SIM_HANDLER
+
+                const size_t n = code.size();
+
+                /*
+                    Running or jumping to the end of the program lands on the record past the end. Every
+                    branch or jump to anywhere else outside the program gets a record of its own after that,
+                    which only knows where the jump went
+                */
+                std::vector<Sim_op> ops(n + 1);
+
+                for(size_t i = 0; i < n; ++i){
+                    Sim_op& op = ops[i];
+                    op = predecode(code[i], i, handlers);
+
+                    if((op.handler == &&op_JAL) && (op.target == i)){
+                        op.handler = &&self_loop;
+
+                    } else if (op.target == BAD_TARGET){
+                        Sim_op bad_target;
+                        bad_target.handler = &&bad_jump;
+                        bad_target.imm = i * 4 + op.imm;
+
+                        op.target = ops.size();
+                        ops.push_back(bad_target);
+                    }
+                }
+
+                ops[n].handler = &&end;
+
+                U64 x[33] = {};
+                x[2] = options.memory_size;
+                x[1] = n * 4;
+
+                Sim_result result;
+                const Sim_op* ops_begin = ops.data();
+                const Sim_op* op = ops_begin;
+                uint8_t* mem = memory;
+                const U64 mem_size = options.memory_size;
+
+                /*
+                    Taken off before every instruction and before landing on a record that only stops the run,
+                    which gives the one back. Hitting 0 means the limit was reached before the next instruction
+                */
+                U64 budget = ((options.max_instructions == 0) || (options.max_instructions == ~0ULL)) ? ~0ULL : (options.max_instructions + 1);
+                U64 start_budget = budget;
+
+                #define NEXT(next) do { \
+                        op = (next); \
+                        if(--budget == 0) goto limit; \
+                        goto *op->handler; \
+                    } while(0)
+
+                #define RR(expr) do { U64 a = x[op->rs1], b = x[op->rs2]; (void)a; (void)b; x[op->rd] = (expr); NEXT(op + 1); } while(0)
+                #define RI(expr) do { U64 a = x[op->rs1]; U64 imm = op->imm; (void)imm; x[op->rd] = (expr); NEXT(op + 1); } while(0)
+                #define W(value) ((U64)(int64_t)(int32_t)(U32)(value))
+
+                #define LOAD(type) do { \
+                        U64 addr = x[op->rs1] + op->imm; \
+                        if(addr > mem_size - sizeof(type)) goto bad_access; \
+                        type value; \
+                        std::memcpy(&value, mem + addr, sizeof(type)); \
+                        x[op->rd] = (U64)value; \
+                        NEXT(op + 1); \
+                    } while(0)
+
+                #define STORE(type) do { \
+                        U64 addr = x[op->rs1] + op->imm; \
+                        if(addr > mem_size - sizeof(type)) goto bad_access; \
+                        type value = (type)x[op->rs2]; \
+                        std::memcpy(mem + addr, &value, sizeof(type)); \
+                        NEXT(op + 1); \
+                    } while(0)
+
+                #define BRANCH(cond) do { \
+                        U64 a = x[op->rs1], b = x[op->rs2]; \
+                        NEXT((cond) ? ops_begin + op->target : op + 1); \
+                    } while(0)
+
+                NEXT(op);
+
+                op_ADD:   RR(a + b);
+                op_SUB:   RR(a - b);
+                op_XOR:   RR(a ^ b);
+                op_OR:    RR(a | b);
+                op_AND:   RR(a & b);
+                op_SLL:   RR(a << (b & 63));
+                op_SRL:   RR(a >> (b & 63));
+                op_SRA:   RR((U64)((int64_t)a >> (b & 63)));
+                op_SLT:   RR((U64)((int64_t)a < (int64_t)b));
+                op_SLTU:  RR((U64)(a < b));
+                op_ADDW:  RR(W(a + b));
+                op_SUBW:  RR(W(a - b));
+                op_SLLW:  RR(W((U32)a << (b & 31)));
+                op_SRLW:  RR(W((U32)a >> (b & 31)));
+                op_SRAW:  RR(W((int32_t)a >> (b & 31)));
+
+                op_MUL:    RR(a * b);
+                op_MULH:   RR((U64)(((__int128)(int64_t)a * (__int128)(int64_t)b) >> 64));
+                op_MULHSU: RR((U64)(((__int128)(int64_t)a * (__int128)b) >> 64));
+                op_MULHU:  RR((U64)(((unsigned __int128)a * b) >> 64));
+                op_DIV:    RR((U64)sim_div<int64_t>(a, b));
+                op_DIVU:   RR(sim_div<U64>(a, b));
+                op_REM:    RR((U64)sim_rem<int64_t>(a, b));
+                op_REMU:   RR(sim_rem<U64>(a, b));
+                op_MULW:   RR(W(a * b));
+                op_DIVW:   RR(W(sim_div<int32_t>(a, b)));
+                op_DIVUW:  RR(W(sim_div<U32>(a, b)));
+                op_REMW:   RR(W(sim_rem<int32_t>(a, b)));
+                op_REMUW:  RR(W(sim_rem<U32>(a, b)));
+
+                op_ADD_UW:    RR(b + (U32)a);
+                op_SH1ADD:    RR(b + (a << 1));
+                op_SH2ADD:    RR(b + (a << 2));
+                op_SH3ADD:    RR(b + (a << 3));
+                op_SH1ADD_UW: RR(b + ((U64)(U32)a << 1));
+                op_SH2ADD_UW: RR(b + ((U64)(U32)a << 2));
+                op_SH3ADD_UW: RR(b + ((U64)(U32)a << 3));
+
+                op_ANDN:  RR(a & ~b);
+                op_ORN:   RR(a | ~b);
+                op_XNOR:  RR(~(a ^ b));
+                op_MIN:   RR(((int64_t)a < (int64_t)b) ? a : b);
+                op_MINU:  RR((a < b) ? a : b);
+                op_MAX:   RR(((int64_t)a < (int64_t)b) ? b : a);
+                op_MAXU:  RR((a < b) ? b : a);
+                op_ROL:   RR(std::rotl(a, b & 63));
+                op_ROR:   RR(std::rotr(a, b & 63));
+                op_ROLW:  RR(W(std::rotl((U32)a, b & 31)));
+                op_RORW:  RR(W(std::rotr((U32)a, b & 31)));
+
+                op_BCLR:  RR(a & ~(1ULL << (b & 63)));
+                op_BEXT:  RR((a >> (b & 63)) & 1);
+                op_BINV:  RR(a ^ (1ULL << (b & 63)));
+                op_BSET:  RR(a | (1ULL << (b & 63)));
+
+                op_ADDI:  RI(a + imm);
+                op_SLLI:  RI(a << imm);
+                op_SLTI:  RI((U64)((int64_t)a < (int64_t)imm));
+                op_SLTIU: RI((U64)(a < imm));
+                op_XORI:  RI(a ^ imm);
+                op_ORI:   RI(a | imm);
+                op_ANDI:  RI(a & imm);
+                op_SRLI:  RI(a >> imm);
+                op_SRAI:  RI((U64)((int64_t)a >> imm));
+                op_ADDIW: RI(W(a + imm));
+                op_SLLIW: RI(W((U32)a << imm));
+                op_SRLIW: RI(W((U32)a >> imm));
+                op_SRAIW: RI(W((int32_t)a >> imm));
+
+                op_SLLI_UW: RI((U64)(U32)a << imm);
+                op_RORI:    RI(std::rotr(a, imm));
+                op_RORIW:   RI(W(std::rotr((U32)a, imm)));
+                op_BCLRI:   RI(a & ~(1ULL << imm));
+                op_BEXTI:   RI((a >> imm) & 1);
+                op_BINVI:   RI(a ^ (1ULL << imm));
+                op_BSETI:   RI(a | (1ULL << imm));
+
+                op_CLZ:    RI((U64)std::countl_zero(a));
+                op_CTZ:    RI((U64)std::countr_zero(a));
+                op_CPOP:   RI((U64)std::popcount(a));
+                op_CLZW:   RI((U64)std::countl_zero((U32)a));
+                op_CTZW:   RI((U64)std::countr_zero((U32)a));
+                op_CPOPW:  RI((U64)std::popcount((U32)a));
+                op_SEXT_B: RI((U64)(int64_t)(int8_t)a);
+                op_SEXT_H: RI((U64)(int64_t)(int16_t)a);
+                op_ZEXT_H: RI(a & 0xffff);
+                op_ORC_B:  RI(sim_orc_b(a));
+                op_REV8:   RI(__builtin_bswap64(a));
+
+                op_LB:    LOAD(int8_t);
+                op_LH:    LOAD(int16_t);
+                op_LW:    LOAD(int32_t);
+                op_LD:    LOAD(U64);
+                op_LBU:   LOAD(uint8_t);
+                op_LHU:   LOAD(uint16_t);
+                op_LWU:   LOAD(U32);
+
+                op_SB:    STORE(uint8_t);
+                op_SH:    STORE(uint16_t);
+                op_SW:    STORE(U32);
+                op_SD:    STORE(U64);
+
+                op_BEQ:   BRANCH(a == b);
+                op_BNE:   BRANCH(a != b);
+                op_BLT:   BRANCH((int64_t)a < (int64_t)b);
+                op_BGE:   BRANCH((int64_t)a >= (int64_t)b);
+                op_BLTU:  BRANCH(a < b);
+                op_BGEU:  BRANCH(a >= b);
+
+                // imm is the final value, worked out while predecoding
+                op_LUI:
+                op_AUIPC:
+                    x[op->rd] = op->imm;
+                    NEXT(op + 1);
+
+                op_JAL:
+                    x[op->rd] = op->link;
+                    NEXT(ops_begin + op->target);
+
+                op_JALR: {
+                    U64 target = (x[op->rs1] + op->imm) & ~1ULL;
+                    x[op->rd] = op->link;
+
+                    if((target & 3) || (target > n * 4)){
+                        budget += 1;
+                        result.pc = target;
+                        result.exit = SIM_BAD_JUMP;
+                        goto done;
+                    }
+
+                    NEXT(ops_begin + (target >> 2));
+                }
+
+                self_loop:
+                    result.exit = SIM_SELF_LOOP;
+                    result.pc = (op - ops_begin) * 4;
+                    budget += 1;
+                    goto done;
+
+                end:
+                    result.exit = SIM_END;
+                    result.pc = n * 4;
+                    budget += 1;
+                    goto done;
+
+                limit:
+                    result.exit = SIM_LIMIT;
+                    result.pc = (op - ops_begin) * 4;
+                    budget += 1;
+                    goto done;
+
+                bad_jump:
+                    result.exit = SIM_BAD_JUMP;
+                    result.pc = op->imm;
+                    budget += 1;
+                    goto done;
+
+                bad_access:
+                    result.exit = SIM_BAD_ACCESS;
+                    result.pc = (op - ops_begin) * 4;
+                    goto done;
+
+                bad_instruction:
+                    result.exit = SIM_BAD_INSTRUCTION;
+                    result.pc = (op - ops_begin) * 4;
+                    goto done;
+
+                done:
+                #undef NEXT
+                #undef RR
+                #undef RI
+                #undef W
+                #undef LOAD
+                #undef STORE
+                #undef BRANCH
+
+                // a trapping instruction counts as run
+                result.instructions = start_budget - budget;
+
+                for(int r = 0; r < 32; ++r){
+                    result.regs[r] = x[r];
+                }
+
+                return result;
+            }
+
+        private:
+            static constexpr U32 BAD_TARGET = ~0u;
+
+            /*
+                one predecoded instruction, `rd` is 32 instead of 0
+            */
+            struct Sim_op {
+                const void* handler = nullptr;
+                // immediate, or the final value for lui/auipc
+                U64 imm = 0;
+                // record index of the branch/jump target
+                U32 target = 0;
+                // return address of jal/jalr
+                U32 link = 0;
+                uint8_t rd = 0;
+                uint8_t rs1 = 0;
+                uint8_t rs2 = 0;
+            };
+
+            Sim_op predecode(U32 word, size_t index, const std::array<const void*, NUM_TOKEN_KINDS>& handlers) const {
+                Decoded d = decode(word);
+                const Operands& o = d.operands;
+                U64 pc = index * 4;
+
+                Sim_op op;
+                op.handler = handlers[d.kind];
+                op.imm = (U64)(int64_t)o.imm;
+                op.rd = (o.rd == 0) ? 32 : o.rd;
+                op.rs1 = o.rs1;
+                op.rs2 = o.rs2;
+                op.link = pc + 4;
+
+                if(d.kind == AUIPC){
+                    op.imm += pc;
+                }
+
+                if((o.format == FORMAT_B) || (o.format == FORMAT_J)){
+                    U64 target = pc + op.imm;
+                    // the end of the program is a fine place to jump to, anything else outside it is not
+                    op.target = ((target & 3) || (target > code.size() * 4)) ? BAD_TARGET : (target >> 2);
+                }
+
+                return op;
+            }
+
+            const std::vector<U32>& code;
+            Sim_options options;
+            uint8_t* memory = nullptr;
+    };
+
+}
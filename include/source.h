@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "utils.h"
+
+namespace Assembler {
+
+    /*
+        Read only view of a whole source file. The file is mmapped so tokens can point straight into it,
+        anything that cannot be mapped (pipes, empty files) is read into an owned buffer instead
+    */
+    class Source_file {
+
+        public:
+            Source_file(){}
+
+            explicit Source_file(const fs::path& path){
+                int fd = ::open(path.c_str(), O_RDONLY);
+
+                if(fd < 0){
+                    PANIC("Cannot open " + path.string());
+                }
+
+                struct stat st;
+
+                if((fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0)){
+                    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+                    if(addr != MAP_FAILED){
+                        madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+                        mapping = addr;
+                        mapping_size = st.st_size;
+                        _text = std::string_view((const char*)addr, mapping_size);
+                    }
+                }
+
+                ::close(fd);
+
+                if(mapping == nullptr){
+                    std::ifstream stream(path, std::ios::binary);
+                    buffer.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+                    _text = buffer;
+                }
+            }
+
+            Source_file(const Source_file&) = delete;
+            Source_file& operator=(const Source_file&) = delete;
+
+            ~Source_file(){
+                if(mapping != nullptr){
+                    munmap(mapping, mapping_size);
+                }
+            }
+
+            /*
+                source that is already in memory, `text` has to outlive the returned file and its tokens
+            */
+            static std::shared_ptr<const Source_file> borrow(std::string_view text){
+                auto file = std::make_shared<Source_file>();
+                file->_text = text;
+                return file;
+            }
+
+            std::string_view text() const { return _text; }
+
+        private:
+            void* mapping = nullptr;
+            size_t mapping_size = 0;
+
+            std::string buffer;
+            std::string_view _text;
+    };
+
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "utils.h"
+
+namespace Assembler {
+
+    /*
+        wall time since construction, in seconds
+    */
+    class Stopwatch {
+
+        public:
+            double seconds() const {
+                return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+
+        private:
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    };
+
+    /*
+        Where the time of one file went and how much work each phase did. Filled in by the driver, the
+        assembler and the writer, `add` sums files into a total for the run
+    */
+    struct File_stats {
+        std::string file;
+        bool ok = false;
+        bool cached = false;
+
+        double lex_seconds = 0;
+        double assemble_seconds = 0;
+        double fixup_seconds = 0;
+        double verify_seconds = 0;
+        double write_seconds = 0;
+
+        size_t tokens = 0;
+        size_t instructions = 0;
+        size_t pseudo_expansions = 0;
+        size_t symbols = 0;
+        size_t fixups = 0;
+        size_t relaxations = 0;
+        size_t compressed = 0;
+        size_t pooled = 0;
+        size_t bytes_written = 0;
+
+        void add(const File_stats& other){
+            lex_seconds += other.lex_seconds;
+            assemble_seconds += other.assemble_seconds;
+            fixup_seconds += other.fixup_seconds;
+            verify_seconds += other.verify_seconds;
+            write_seconds += other.write_seconds;
+
+            tokens += other.tokens;
+            instructions += other.instructions;
+            pseudo_expansions += other.pseudo_expansions;
+            symbols += other.symbols;
+            fixups += other.fixups;
+            relaxations += other.relaxations;
+            compressed += other.compressed;
+            pooled += other.pooled;
+            bytes_written += other.bytes_written;
+        }
+
+        void to_json(std::ostream& out, const char* indent) const {
+            out << "{\n"
+                << indent << "    \"lex_seconds\": " << lex_seconds << ",\n"
+                << indent << "    \"assemble_seconds\": " << assemble_seconds << ",\n"
+                << indent << "    \"fixup_seconds\": " << fixup_seconds << ",\n"
+                << indent << "    \"verify_seconds\": " << verify_seconds << ",\n"
+                << indent << "    \"write_seconds\": " << write_seconds << ",\n"
+                << indent << "    \"tokens\": " << tokens << ",\n"
+                << indent << "    \"instructions\": " << instructions << ",\n"
+                << indent << "    \"pseudo_expansions\": " << pseudo_expansions << ",\n"
+                << indent << "    \"symbols\": " << symbols << ",\n"
+                << indent << "    \"fixups\": " << fixups << ",\n"
+                << indent << "    \"relaxations\": " << relaxations << ",\n"
+                << indent << "    \"compressed\": " << compressed << ",\n"
+                << indent << "    \"pooled\": " << pooled << ",\n"
+                << indent << "    \"bytes_written\": " << bytes_written;
+        }
+    };
+
+    inline std::string json_escape(std::string_view text){
+        std::string escaped;
+
+        for(char c : text){
+            if((c == '"') || (c == '\\')){
+                escaped += '\\';
+                escaped += c;
+            } else if ((unsigned char)c < 0x20){
+                char buffer[8];
+                std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                escaped += buffer;
+            } else {
+                escaped += c;
+            }
+        }
+
+        return escaped;
+    }
+
+    /*
+        {"files": [...], "total": {...}}, the total also has the wall time of the whole run
+    */
+    inline std::string stats_to_json(const std::vector<File_stats>& files, double wall_seconds){
+        std::ostringstream out;
+        File_stats total;
+        size_t failed = 0;
+        size_t cached = 0;
+
+        out << "{\n    \"files\": [\n";
+
+        for(size_t i = 0; i < files.size(); ++i){
+            const File_stats& file = files[i];
+
+            out << "        ";
+            file.to_json(out, "        ");
+            out << ",\n"
+                << "            \"file\": \"" << json_escape(file.file) << "\",\n"
+                << "            \"ok\": " << (file.ok ? "true" : "false") << ",\n"
+                << "            \"cached\": " << (file.cached ? "true" : "false") << "\n"
+                << "        }" << ((i + 1 < files.size()) ? "," : "") << "\n";
+
+            total.add(file);
+            failed += !file.ok;
+            cached += file.cached;
+        }
+
+        out << "    ],\n    \"total\": ";
+        total.to_json(out, "    ");
+        out << ",\n"
+            << "        \"files\": " << files.size() << ",\n"
+            << "        \"failed\": " << failed << ",\n"
+            << "        \"cached\": " << cached << ",\n"
+            << "        \"wall_seconds\": " << wall_seconds << "\n"
+            << "    }\n}\n";
+
+        return out.str();
+    }
+
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Assembler {
+
+    /*
+        Work stealing thread pool. Every worker owns a deque, it pops its own work from the back and steals
+        from the front of the other deques when it runs dry. Tasks submitted from outside the pool are dealt
+        round robin, tasks submitted from a worker go to that worker's own deque
+    */
+    class Thread_pool {
+
+        public:
+            explicit Thread_pool(size_t n_threads) :
+                queues(std::max<size_t>(n_threads, 1))
+            {
+                for(size_t i = 0; i < queues.size(); ++i){
+                    queues[i] = std::make_unique<Work_queue>();
+                }
+
+                for(size_t i = 0; i < queues.size(); ++i){
+                    workers.emplace_back([this, i]{ worker_loop(i); });
+                }
+            }
+
+            Thread_pool(const Thread_pool&) = delete;
+            Thread_pool& operator=(const Thread_pool&) = delete;
+
+            ~Thread_pool(){
+                {
+                    std::lock_guard<std::mutex> lock(sleep_mutex);
+                    stopping = true;
+                }
+                wake.notify_all();
+
+                for(std::thread& t : workers){
+                    t.join();
+                }
+            }
+
+            size_t size() const { return workers.size(); }
+
+            void submit(std::function<void()> task){
+                size_t q = (worker_index >= 0 && owner == this) ? worker_index : (next_queue++ % queues.size());
+
+                unfinished++;
+
+                {
+                    std::lock_guard<std::mutex> lock(queues[q]->mutex);
+                    queues[q]->tasks.push_back(std::move(task));
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(sleep_mutex);
+                    queued++;
+                }
+                wake.notify_one();
+            }
+
+            /*
+                block until every task submitted so far has finished
+            */
+            void wait(){
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                idle.wait(lock, [this]{ return unfinished == 0; });
+            }
+
+        private:
+            struct Work_queue {
+                std::mutex mutex;
+                std::deque<std::function<void()>> tasks;
+            };
+
+            bool try_pop(size_t self, std::function<void()>& task){
+                {
+                    std::lock_guard<std::mutex> lock(queues[self]->mutex);
+
+                    if(!queues[self]->tasks.empty()){
+                        task = std::move(queues[self]->tasks.back());
+                        queues[self]->tasks.pop_back();
+                        return true;
+                    }
+                }
+
+                for(size_t i = 1; i < queues.size(); ++i){
+                    Work_queue& victim = *queues[(self + i) % queues.size()];
+                    std::lock_guard<std::mutex> lock(victim.mutex);
+
+                    if(!victim.tasks.empty()){
+                        task = std::move(victim.tasks.front());
+                        victim.tasks.pop_front();
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            void worker_loop(size_t self){
+                worker_index = self;
+                owner = this;
+
+                std::function<void()> task;
+
+                while(true){
+                    {
+                        std::unique_lock<std::mutex> lock(sleep_mutex);
+                        wake.wait(lock, [this]{ return stopping || (queued > 0); });
+
+                        if(queued == 0) return;
+                        queued--;
+                    }
+
+                    // a task is reserved for us, but it may sit in any deque
+                    while(!try_pop(self, task)){
+                        std::this_thread::yield();
+                    }
+
+                    task();
+                    task = nullptr;
+
+                    if(--unfinished == 0){
+                        std::lock_guard<std::mutex> lock(sleep_mutex);
+                        idle.notify_all();
+                    }
+                }
+            }
+
+            std::vector<std::unique_ptr<Work_queue>> queues;
+            std::vector<std::thread> workers;
+
+            std::mutex sleep_mutex;
+            std::condition_variable wake;
+            std::condition_variable idle;
+            size_t queued = 0;
+            bool stopping = false;
+
+            std::atomic<size_t> unfinished = 0;
+            std::atomic<size_t> next_queue = 0;
+
+            static inline thread_local long worker_index = -1;
+            static inline thread_local const Thread_pool* owner = nullptr;
+    };
+
+}
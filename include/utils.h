@@ -7,6 +7,9 @@
 #include <assert.h>
 #include <unordered_map>
 #include <filesystem>
+#include <string_view>
+#include <charconv>
+#include <stdexcept>
 
 #define set_bit(n) (1UL << n)
 
@@ -21,13 +24,40 @@ namespace fs = std::filesystem;
 #define ANNOT(x) (std::string("at ") + __FILE__ + "," + std::to_string(__LINE__) + ": " + (x))
 
 // logging
-#define ERROR(x) std::cerr << (std::string("[ERROR] ") + RED(ANNOT(x))) << std::endl
-#define WARNING(x) std::cerr << (std::string("[WARNING] ") + YELLOW(ANNOT(x))) << std::endl
-#define INFO(x) std::cout << (std::string("[INFO] ") + GREEN(x)) << std::endl
-#define PANIC(x) do { \
-        ERROR(x); \
-        exit(-1); \
+/*
+    Levels above MAX_LOG_LEVEL are compiled out, the message isn't even formatted. Release builds (NDEBUG)
+    drop TRACE, the rest is filtered at runtime by `log_level`. `x` can be anything that can be streamed
+*/
+#ifndef MAX_LOG_LEVEL
+    #ifdef NDEBUG
+        #define MAX_LOG_LEVEL ::Assembler::LOG_DEBUG
+    #else
+        #define MAX_LOG_LEVEL ::Assembler::LOG_TRACE
+    #endif
+#endif
+
+#define LOG(level, x) do { \
+        if(((level) <= MAX_LOG_LEVEL) && ::Assembler::log_enabled(level)){ \
+            ::Assembler::log_stream(level) << x << '\n'; \
+        } \
+    } while(0)
+
+/*
+    Errors and warnings about a place in the input get its `line:column` as `where`, see `diagnostic` for
+    how they are printed
+*/
+#define ERROR_AT(where, x) LOG(::Assembler::LOG_ERROR, ::Assembler::diagnostic(where, "error", x, "[ERROR] " + RED(ANNOT(x))))
+#define WARNING_AT(where, x) LOG(::Assembler::LOG_WARNING, ::Assembler::diagnostic(where, "warning", x, "[WARNING] " + YELLOW(ANNOT(x))))
+#define ERROR(x) ERROR_AT("", x)
+#define WARNING(x) WARNING_AT("", x)
+#define INFO(x) LOG(::Assembler::LOG_INFO, x)
+#define DEBUG(x) LOG(::Assembler::LOG_DEBUG, x)
+#define TRACE(x) LOG(::Assembler::LOG_TRACE, x)
+#define PANIC_AT(where, x) do { \
+        ERROR_AT(where, x); \
+        throw ::Assembler::Fatal_error(x); \
     } while(0);
+#define PANIC(x) PANIC_AT("", x)
 
 #define HEX(x) std::setfill('0') << std::setw(8) << std::hex << x << std::dec
 
@@ -37,11 +67,69 @@ namespace fs = std::filesystem;
 #define FITS_IN_12_BITS(x) ((x & ~BITMASK_12) == 0)
 #define FITS_IN_20_BITS(x) ((x & ~BITMASK_20) == 0)
 
-using U32 = uint64_t;
+using U32 = uint32_t;
 using U64 = uint64_t;
 
 namespace Assembler {
 
+    /*
+        Thrown by PANIC, aborts the current file only
+    */
+    struct Fatal_error : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    /*
+        Where log output of the current thread goes, the driver points these at per file buffers so that
+        diagnostics of files assembled in parallel don't interleave
+    */
+    struct Log_streams {
+        std::ostream* out = &std::cout;
+        std::ostream* err = &std::cerr;
+        // no colour and no assembler source locations, for diagnostics that don't go to a terminal
+        bool plain = false;
+        // path of the input being assembled, in front of every error and warning
+        std::string input;
+    };
+
+    inline thread_local Log_streams log_streams;
+
+    /*
+        One error or warning, after the input and its `where` in it, as far as they are known. On a terminal it
+        is `decorated`, coloured and with the place in the assembler it comes from. `plain` streams get
+        `error: <message>` instead, the way compilers print them
+    */
+    inline std::string diagnostic(const std::string& where, const char* severity, const std::string& message, const std::string& decorated){
+        std::string location = (log_streams.input.empty() || where.empty()) ? log_streams.input + where : log_streams.input + ":" + where;
+
+        if(!location.empty()){
+            location += ": ";
+        }
+
+        return log_streams.plain ? location + severity + ": " + message : location + decorated;
+    }
+
+    inline std::ostream& log_out(){ return *log_streams.out; }
+
+    inline std::ostream& log_err(){ return *log_streams.err; }
+
+    enum Log_level {
+        LOG_ERROR,      // -q
+        LOG_WARNING,
+        LOG_INFO,       // default
+        LOG_DEBUG,      // -v
+        LOG_TRACE,      // -vv
+    };
+
+    // set once from the command line, before any file is assembled
+    inline Log_level log_level = LOG_INFO;
+
+    inline bool log_enabled(Log_level level){ return level <= log_level; }
+
+    inline std::ostream& log_stream(Log_level level){
+        return (level <= LOG_WARNING) ? log_err() : log_out();
+    }
+
     enum Register_port {
         RD,
         RS1,
@@ -93,34 +181,34 @@ namespace Assembler {
             }
 
         private:
-            U32 opcode;
-            U32 funct3;
-            U32 funct7;
+            U32 opcode = 0;
+            U32 funct3 = 0;
+            U32 funct7 = 0;
 
             std::optional<Pseudo_instruction_data> psi_data;
 
     };
 
-    inline void to_file(std::ofstream& stream, const U32& num){
-        stream << HEX(num) << std::endl;
-    }
+    /*
+        same rules as strtoul with base 0: `0x` prefix is hex, a leading 0 is octal, a leading `-` wraps around
+    */
+    inline U64 parse_int(std::string_view text){
+        bool negative = !text.empty() && (text[0] == '-');
+        if(negative) text.remove_prefix(1);
 
+        int base = 10;
 
-    inline U32 get_bits(U32 source, int msb, int lsb) {
-        int width = msb - lsb + 1;
-        U32 mask = (1U << width) - 1; // for width 8, this would be OxFF
-        return (source >> lsb) & mask;
-    }
+        if((text.size() > 2) && (text[0] == '0') && ((text[1] | 0x20) == 'x')){
+            base = 16;
+            text.remove_prefix(2);
+        } else if ((text.size() > 1) && (text[0] == '0')){
+            base = 8;
+        }
 
+        U64 value = 0;
+        std::from_chars(text.data(), text.data() + text.size(), value, base);
 
-    inline void place_bits(U32& target, U32 field_value, int low_bit, int width) {
-        // almost the same as `mask` above. Just shifted in the target position, then negated
-        U32 clearing_mask = ~(((1U << width) - 1) << low_bit);
-        
-        target &= clearing_mask;
-        
-        // place value at target position
-        target |= (field_value << low_bit);
+        return negative ? -value : value;
     }
 
 }
\ No newline at end of file
@@ -0,0 +1,217 @@
+#pragma once
+
+#include "encoder.h"
+
+namespace Assembler {
+
+    /*
+        RVV 1.0, the `VECTOR` entries of instructions.def. Every vector instruction lays its fields out like
+        an R type (vd, vs1/rs1/imm5, vs2/rs2) or, for vsetvli and vsetivli, an I type instruction, so parsed
+        vector instructions are plain `Operands` that the encoder takes as they are: funct6, vm and the
+        fields an instruction keeps fixed are part of `base`, and an imm5 goes where rs1 would be
+    */
+
+    /*
+        operands of each kind of vector instruction, in the order they are written
+    */
+    enum Vector_form : uint8_t {
+        VFORM_VV,               // vd, vs2, vs1[, v0.t]
+        VFORM_VX,               // vd, vs2, rs1[, v0.t]
+        VFORM_VI,               // vd, vs2, simm5[, v0.t]
+        VFORM_VI_UNSIGNED,      // vd, vs2, uimm5[, v0.t]
+        VFORM_MACC_VV,          // vd, vs1, vs2[, v0.t], multiply adds write the multiplicand first
+        VFORM_MACC_VX,          // vd, rs1, vs2[, v0.t]
+        VFORM_VVM,              // vd, vs2, vs1, v0
+        VFORM_VXM,              // vd, vs2, rs1, v0
+        VFORM_VIM,              // vd, vs2, simm5, v0
+        VFORM_MV_V,             // vd, vs1
+        VFORM_MV_X,             // vd, rs1
+        VFORM_MV_I,             // vd, simm5
+        VFORM_X_S,              // rd, vs2
+        VFORM_S_X,              // vd, rs1
+        VFORM_UNIT,             // vd, (rs1)[, v0.t], vs3 instead of vd for stores
+        VFORM_STRIDED,          // vd, (rs1), rs2[, v0.t]
+        VFORM_INDEXED,          // vd, (rs1), vs2[, v0.t]
+        VFORM_SETVLI,           // rd, rs1, vtypei
+        VFORM_SETIVLI,          // rd, uimm5, vtypei
+        VFORM_SETVL,            // rd, rs1, rs2
+    };
+
+    constexpr U32 VM_BIT = 1u << 25;
+
+    /*
+        forms that take an optional `v0.t`, which clears vm, as a bit set of `Vector_form`s
+    */
+    inline constexpr U32 MASKABLE_VECTOR_FORMS = (1 << VFORM_VV) | (1 << VFORM_VX) | (1 << VFORM_VI) | (1 << VFORM_VI_UNSIGNED)
+        | (1 << VFORM_MACC_VV) | (1 << VFORM_MACC_VX) | (1 << VFORM_UNIT) | (1 << VFORM_STRIDED) | (1 << VFORM_INDEXED);
+
+    constexpr bool vector_form_is_maskable(Vector_form form){
+        return (MASKABLE_VECTOR_FORMS >> form) & 1;
+    }
+
+    struct Vector_spec {
+        // opcode, funct3, funct6 and the fixed fields
+        U32 base;
+        // bits that identify the instruction, `base` holds their value
+        U32 mask;
+        Vector_form form;
+        Instr_format format;
+    };
+
+    constexpr Vector_spec vector_spec(U32 opcode, U32 funct3, U32 funct6, Vector_form form){
+        Vector_spec spec{opcode | (funct3 << 12) | (funct6 << 26), 0xfc00707f, form, FORMAT_R};
+
+        switch(form){
+            case VFORM_VV:
+            case VFORM_VX:
+            case VFORM_VI:
+            case VFORM_VI_UNSIGNED:
+            case VFORM_MACC_VV:
+            case VFORM_MACC_VX:
+            case VFORM_STRIDED:
+            case VFORM_INDEXED: break;
+
+            case VFORM_VVM:
+            case VFORM_VXM:
+            case VFORM_VIM:
+            case VFORM_SETVL: spec.mask |= VM_BIT; break;
+
+            // unmasked, vs2 is 0
+            case VFORM_MV_V:
+            case VFORM_MV_X:
+            case VFORM_MV_I:
+            case VFORM_S_X: spec.base |= VM_BIT; spec.mask |= VM_BIT | (0x1f << 20); break;
+
+            // unmasked, vs1 is 0
+            case VFORM_X_S: spec.base |= VM_BIT; spec.mask |= VM_BIT | (0x1f << 15); break;
+
+            // lumop/sumop, 0 for the plain unit stride access
+            case VFORM_UNIT: spec.mask |= 0x1f << 20; break;
+
+            // vtypei is bits 30:20 of vsetvli and 29:20 of vsetivli, the bits above it are fixed
+            case VFORM_SETVLI: spec.mask = 0x8000707f; spec.format = FORMAT_I; break;
+            case VFORM_SETIVLI: spec.mask = 0xc000707f; spec.format = FORMAT_I; break;
+        }
+
+        return spec;
+    }
+
+    constexpr Vector_spec VECTOR_SPECS[] = {
+        #define VECTOR(kind, mnemonic, opcode, funct3, funct6, form) vector_spec(opcode, funct3, funct6, VFORM_##form),
+        #include "instructions.def"
+    };
+
+    constexpr const char* VECTOR_MNEMONICS[] = {
+        #define VECTOR(kind, mnemonic, ...) mnemonic,
+        #include "instructions.def"
+    };
+
+    /*
+        operand record of vector instruction `kind`, unmasked if it can be masked, every operand still zero
+    */
+    constexpr Operands vector_operands_for(Vector_kind kind){
+        const Vector_spec& spec = VECTOR_SPECS[kind];
+
+        Operands operands;
+        operands.base = spec.base | (vector_form_is_maskable(spec.form) ? VM_BIT : 0);
+        operands.format = spec.format;
+
+        return operands;
+    }
+
+    /*
+        A masked instruction can't have v0, the mask it reads, as vd. Stores only read vd, and compares and
+        reductions write a mask or a single element, which may land on the mask
+    */
+    constexpr bool vector_masked_vd_can_be_v0(Vector_kind kind){
+        U32 base = VECTOR_SPECS[kind].base;
+        U32 opcode = base & 0x7f;
+        U32 funct3 = (base >> 12) & 0x7;
+        U32 funct6 = base >> 26;
+
+        bool compare = (funct3 != 2) && (funct3 != 6) && (funct6 >= 0x18) && (funct6 <= 0x1f);
+        bool reduction = (funct3 == 2) && (funct6 <= 0x07);
+
+        return (opcode == 0b0100111) || ((opcode == 0b1010111) && (compare || reduction));
+    }
+
+    static_assert(vector_masked_vd_can_be_v0(VMSLTU_VX) && vector_masked_vd_can_be_v0(VREDSUM_VS) && vector_masked_vd_can_be_v0(VSE8_V));
+    static_assert(!vector_masked_vd_can_be_v0(VADD_VI) && !vector_masked_vd_can_be_v0(VMACC_VV) && !vector_masked_vd_can_be_v0(VLE8_V));
+
+    /*
+        Index into `VECTOR_DECODE_TABLE`: funct3, funct6 and vm tell every vector instruction apart once the
+        opcode is known, vm only for vmerge and vmv.v. Bits 6:5 of the three vector opcodes are 00, 01 and 10
+    */
+    constexpr size_t vector_decode_index(U32 word){
+        return (((word >> 5) & 0x3) << 10) | (((word >> 12) & 0x7) << 7)
+            | ((word >> 26) << 1) | ((word >> 25) & 0x1);
+    }
+
+    /*
+        the one `Vector_kind` each index can be, NUM_VECTOR_KINDS if none
+    */
+    constexpr auto VECTOR_DECODE_TABLE = [] {
+        std::array<uint8_t, 3 << 10> table{};
+        table.fill(NUM_VECTOR_KINDS);
+
+        for(size_t kind = 0; kind < NUM_VECTOR_KINDS; ++kind){
+            const Vector_spec& spec = VECTOR_SPECS[kind];
+
+            for(U32 fields = 0; fields < (8 << 7); ++fields){
+                U32 word = (spec.base & ~0xfe007000u) | ((fields >> 7) << 12) | ((fields & 0x7f) << 25);
+
+                if((word & spec.mask) != spec.base) continue;
+
+                uint8_t& entry = table[vector_decode_index(word)];
+
+                if(entry != NUM_VECTOR_KINDS){
+                    throw "two vector instructions share a decode table entry";
+                }
+
+                entry = kind;
+            }
+        }
+
+        return table;
+    }();
+
+    /*
+        The words of a vtypei, `e32, m1, ta, ma`. Each sets the bits of `field`, sew has to come first and
+        the others are optional: m1, tu and mu if left out
+    */
+    struct Vtype_word {
+        std::string_view spelling;
+        U32 field;
+        U32 bits;
+    };
+
+    constexpr U32 VTYPE_LMUL = 0x07;
+    constexpr U32 VTYPE_SEW = 0x38;
+    constexpr U32 VTYPE_TAIL = 0x40;
+    constexpr U32 VTYPE_MASK = 0x80;
+
+    constexpr Vtype_word VTYPE_WORDS[] = {
+        {"e8", VTYPE_SEW, 0 << 3}, {"e16", VTYPE_SEW, 1 << 3}, {"e32", VTYPE_SEW, 2 << 3}, {"e64", VTYPE_SEW, 3 << 3},
+        {"m1", VTYPE_LMUL, 0}, {"m2", VTYPE_LMUL, 1}, {"m4", VTYPE_LMUL, 2}, {"m8", VTYPE_LMUL, 3},
+        {"mf8", VTYPE_LMUL, 5}, {"mf4", VTYPE_LMUL, 6}, {"mf2", VTYPE_LMUL, 7},
+        {"tu", VTYPE_TAIL, 0}, {"ta", VTYPE_TAIL, VTYPE_TAIL},
+        {"mu", VTYPE_MASK, 0}, {"ma", VTYPE_MASK, VTYPE_MASK},
+    };
+
+    /*
+        case insensitive, nullptr for anything that isn't a vtype word
+    */
+    constexpr const Vtype_word* find_vtype_word(std::string_view text){
+        for(const Vtype_word& word : VTYPE_WORDS){
+            if(keyword_equals(word.spelling, text.data(), text.size())) return &word;
+        }
+
+        return nullptr;
+    }
+
+    static_assert(encode([]{ Operands o = vector_operands_for(VADD_VV); o.rd = 8; o.rs2 = 8; o.rs1 = 9; return o; }()) == 0x02848457, "vadd.vv v8, v8, v9");
+    static_assert(encode([]{ Operands o = vector_operands_for(VLE32_V); o.rd = 8; o.rs1 = 10; return o; }()) == 0x02056407, "vle32.v v8, (a0)");
+    static_assert(encode([]{ Operands o = vector_operands_for(VSETVLI); o.rd = 5; o.rs1 = 10; o.imm = 0xd0; return o; }()) == 0x0d0572d7, "vsetvli t0, a0, e32, m1, ta, ma");
+    static_assert(encode([]{ Operands o = vector_operands_for(VMACC_VX); o.rd = 4; o.rs1 = 11; o.rs2 = 6; o.base &= ~VM_BIT; return o; }()) == 0xb465e257, "vmacc.vx v4, a1, v6, v0.t");
+
+}
@@ -0,0 +1,368 @@
+#pragma once
+
+#include <elf.h>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "utils.h"
+
+namespace Assembler {
+
+    /*
+        a defined label, `address` is in bytes from the start of the code image
+    */
+    struct Symbol {
+        std::string name;
+        U64 address;
+    };
+
+    /*
+        The code is one word per instruction. A word whose lowest two bits aren't both set is a 16 bit RVC
+        instruction, which takes 2 bytes in the image, unless it is data (see `Data_range`)
+    */
+    inline size_t instruction_size(U32 word){
+        return ((word & 0x3) == 0x3) ? 4 : 2;
+    }
+
+    /*
+        Words of the image that are data instead of instructions, the literal pools, as index ranges in
+        ascending order. A data word takes 4 bytes whatever its lowest two bits are
+    */
+    struct Data_range {
+        U32 begin;
+        U32 end;
+    };
+
+    /*
+        calls `visit(word, size)` for every word of the code in order
+    */
+    template<typename Visit>
+    inline void for_each_word(const std::vector<U32>& code, const std::vector<Data_range>& data, Visit&& visit){
+        auto range = data.begin();
+
+        for(size_t i = 0; i < code.size(); ++i){
+            while((range != data.end()) && (range->end <= i)) ++range;
+
+            bool is_data = (range != data.end()) && (range->begin <= i);
+
+            visit(code[i], is_data ? 4 : instruction_size(code[i]));
+        }
+    }
+
+    /*
+        the code image as little endian bytes
+    */
+    inline std::string code_bytes(const std::vector<U32>& code, const std::vector<Data_range>& data){
+        std::string bytes(code.size() * 4, '\0');
+        char* p = bytes.data();
+
+        for_each_word(code, data, [&](U32 word, size_t size){
+            for(size_t byte = 0; byte < 4; ++byte){
+                p[byte] = (char)((word >> (8 * byte)) & 0xff);
+            }
+
+            p += size;
+        });
+
+        bytes.resize(p - bytes.data());
+
+        return bytes;
+    }
+
+    /*
+        Writes out a finished code image. Each output format is one subclass, the whole image is handed over in
+        one call so a writer can format it into a single buffer and write that in one go
+    */
+    class Code_writer {
+
+        public:
+            virtual ~Code_writer() = default;
+
+            // extension of the output file, including the dot
+            virtual const char* extension() const = 0;
+
+            virtual void write(const std::vector<U32>& code, const std::vector<Data_range>& data, const std::vector<Symbol>& symbols, std::ostream& out) const = 0;
+
+            /*
+                returns the number of bytes written
+            */
+            size_t write_file(const std::vector<U32>& code, const std::vector<Data_range>& data, const std::vector<Symbol>& symbols, const fs::path& path) const {
+                // never write in place, `path` may be a hardlink into the build cache
+                std::error_code ec;
+                fs::remove(path, ec);
+
+                std::ofstream out(path, std::ios::binary | std::ios::trunc);
+
+                if(!out){
+                    PANIC("Could not open " + path.string() + " for writing");
+                }
+
+                write(code, data, symbols, out);
+
+                if(!out.flush()){
+                    PANIC("Could not write " + path.string());
+                }
+
+                return out.tellp();
+            }
+    };
+
+    /*
+        both hex digits of every byte value
+    */
+    constexpr std::array<char, 512> make_hex_byte_table(const char* digits){
+        std::array<char, 512> table {};
+
+        for(int i = 0; i < 256; ++i){
+            table[2 * i] = digits[i >> 4];
+            table[2 * i + 1] = digits[i & 0xf];
+        }
+
+        return table;
+    }
+
+    inline constexpr std::array<char, 512> HEX_BYTE_TABLE = make_hex_byte_table("0123456789abcdef");
+    inline constexpr std::array<char, 512> HEX_BYTE_TABLE_UPPER = make_hex_byte_table("0123456789ABCDEF");
+
+    /*
+        writes the hex digits of the lower `num_bytes` bytes of `word` to `out`, returns the end of what was
+        written
+    */
+    inline char* format_hex_word(char* out, U32 word, int num_bytes = 4){
+        for(int byte = num_bytes - 1; byte >= 0; --byte){
+            const char* pair = &HEX_BYTE_TABLE[2 * ((word >> (8 * byte)) & 0xff)];
+            *out++ = pair[0];
+            *out++ = pair[1];
+        }
+
+        return out;
+    }
+
+    /*
+        one instruction or data word per line as 8 hex digits, 4 for a 16 bit instruction
+    */
+    class Hex_writer : public Code_writer {
+
+        public:
+            const char* extension() const override { return ".txt"; }
+
+            void write(const std::vector<U32>& code, const std::vector<Data_range>& data, const std::vector<Symbol>&, std::ostream& out) const override {
+                std::string buffer(code.size() * 9, '\0');
+                char* p = buffer.data();
+
+                for_each_word(code, data, [&](U32 word, size_t size){
+                    p = format_hex_word(p, word, size);
+                    *p++ = '\n';
+                });
+
+                out.write(buffer.data(), p - buffer.data());
+            }
+    };
+
+    /*
+        raw little endian words, ready to be mmapped or copied into memory
+    */
+    class Bin_writer : public Code_writer {
+
+        public:
+            const char* extension() const override { return ".bin"; }
+
+            void write(const std::vector<U32>& code, const std::vector<Data_range>& data, const std::vector<Symbol>&, std::ostream& out) const override {
+                std::string buffer = code_bytes(code, data);
+
+                out.write(buffer.data(), buffer.size());
+            }
+    };
+
+    /*
+        Intel HEX, 16 data bytes per record. An extended linear address record starts every 64 KiB
+    */
+    class Ihex_writer : public Code_writer {
+
+        public:
+            const char* extension() const override { return ".hex"; }
+
+            void write(const std::vector<U32>& code, const std::vector<Data_range>& data, const std::vector<Symbol>&, std::ostream& out) const override {
+                std::string bytes = code_bytes(code, data);
+                std::string buffer;
+                // 16 data bytes take 44 characters, one extended address record per 4096 data records
+                buffer.reserve((bytes.size() / 16 + 2) * 44 + 64);
+
+                size_t num_bytes = bytes.size();
+
+                for(size_t address = 0; address < num_bytes; address += RECORD_SIZE){
+
+                    if((address & 0xffff) == 0 && address != 0){
+                        uint8_t upper[2] = {(uint8_t)(address >> 24), (uint8_t)(address >> 16)};
+                        put_record(buffer, 0, 0x04, upper, 2);
+                    }
+
+                    size_t length = std::min(RECORD_SIZE, num_bytes - address);
+
+                    put_record(buffer, address & 0xffff, 0x00, (const uint8_t*)&bytes[address], length);
+                }
+
+                // end of file
+                put_record(buffer, 0, 0x01, nullptr, 0);
+
+                out.write(buffer.data(), buffer.size());
+            }
+
+        private:
+            static constexpr size_t RECORD_SIZE = 16;
+
+            static void put_byte(std::string& buffer, uint8_t byte){
+                buffer.append(&HEX_BYTE_TABLE_UPPER[2 * byte], 2);
+            }
+
+            /*
+                `:` length, address, type, data and a two's complement checksum of all of them
+            */
+            static void put_record(std::string& buffer, U32 address, uint8_t type, const uint8_t* data, size_t length){
+                uint8_t checksum = length + (address >> 8) + address + type;
+
+                buffer += ':';
+                put_byte(buffer, length);
+                put_byte(buffer, address >> 8);
+                put_byte(buffer, address);
+                put_byte(buffer, type);
+
+                for(size_t i = 0; i < length; ++i){
+                    put_byte(buffer, data[i]);
+                    checksum += data[i];
+                }
+
+                put_byte(buffer, -checksum);
+                buffer += '\n';
+            }
+    };
+
+    /*
+        ELF64 relocatable object for RISC-V with the code in .text and every label as a local symbol of .text.
+        The headers are written straight from the <elf.h> structs, so this needs a little endian host
+    */
+    class Elf_writer : public Code_writer {
+
+        public:
+            const char* extension() const override { return ".o"; }
+
+            void write(const std::vector<U32>& code, const std::vector<Data_range>& data, const std::vector<Symbol>& symbols, std::ostream& out) const override {
+                static_assert(std::endian::native == std::endian::little, "ELF output is written with host byte order");
+
+                enum { SEC_NULL, SEC_TEXT, SEC_SYMTAB, SEC_STRTAB, SEC_SHSTRTAB, NUM_SECTIONS };
+
+                const char shstrtab[] = "\0.text\0.symtab\0.strtab\0.shstrtab";
+                const U32 name_offsets[NUM_SECTIONS] = {0, 1, 7, 15, 23};
+
+                // symbol 0 is the null symbol, 1 the section symbol of .text
+                std::string strtab(1, '\0');
+                std::vector<Elf64_Sym> symtab(2, Elf64_Sym{});
+                symtab[1].st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+                symtab[1].st_shndx = SEC_TEXT;
+
+                for(const Symbol& symbol : symbols){
+                    Elf64_Sym sym {};
+                    sym.st_name = strtab.size();
+                    sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_NOTYPE);
+                    sym.st_shndx = SEC_TEXT;
+                    sym.st_value = symbol.address;
+
+                    strtab.append(symbol.name);
+                    strtab += '\0';
+                    symtab.push_back(sym);
+                }
+
+                // file layout: header, .text, .symtab, .strtab, .shstrtab, section headers
+                std::string text = code_bytes(code, data);
+
+                U64 text_offset = sizeof(Elf64_Ehdr);
+                U64 text_size = text.size();
+                U64 symtab_offset = align_to(text_offset + text_size, 8);
+                U64 symtab_size = symtab.size() * sizeof(Elf64_Sym);
+                U64 strtab_offset = symtab_offset + symtab_size;
+                U64 shstrtab_offset = strtab_offset + strtab.size();
+                U64 shdr_offset = align_to(shstrtab_offset + sizeof(shstrtab), 8);
+
+                Elf64_Ehdr header {};
+                std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+                header.e_ident[EI_CLASS] = ELFCLASS64;
+                header.e_ident[EI_DATA] = ELFDATA2LSB;
+                header.e_ident[EI_VERSION] = EV_CURRENT;
+                header.e_ident[EI_OSABI] = ELFOSABI_NONE;
+                header.e_type = ET_REL;
+                header.e_machine = EM_RISCV;
+                header.e_version = EV_CURRENT;
+                header.e_flags = (text_size == code.size() * 4) ? 0 : EF_RISCV_RVC;
+                header.e_shoff = shdr_offset;
+                header.e_ehsize = sizeof(Elf64_Ehdr);
+                header.e_shentsize = sizeof(Elf64_Shdr);
+                header.e_shnum = NUM_SECTIONS;
+                header.e_shstrndx = SEC_SHSTRTAB;
+
+                Elf64_Shdr sections[NUM_SECTIONS] {};
+
+                for(int i = 0; i < NUM_SECTIONS; ++i){
+                    sections[i].sh_name = name_offsets[i];
+                }
+
+                sections[SEC_TEXT].sh_type = SHT_PROGBITS;
+                sections[SEC_TEXT].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+                sections[SEC_TEXT].sh_offset = text_offset;
+                sections[SEC_TEXT].sh_size = text_size;
+                sections[SEC_TEXT].sh_addralign = (text_size == code.size() * 4) ? 4 : 2;
+
+                sections[SEC_SYMTAB].sh_type = SHT_SYMTAB;
+                sections[SEC_SYMTAB].sh_offset = symtab_offset;
+                sections[SEC_SYMTAB].sh_size = symtab_size;
+                sections[SEC_SYMTAB].sh_link = SEC_STRTAB;
+                // every symbol is local
+                sections[SEC_SYMTAB].sh_info = symtab.size();
+                sections[SEC_SYMTAB].sh_addralign = 8;
+                sections[SEC_SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+
+                sections[SEC_STRTAB].sh_type = SHT_STRTAB;
+                sections[SEC_STRTAB].sh_offset = strtab_offset;
+                sections[SEC_STRTAB].sh_size = strtab.size();
+                sections[SEC_STRTAB].sh_addralign = 1;
+
+                sections[SEC_SHSTRTAB].sh_type = SHT_STRTAB;
+                sections[SEC_SHSTRTAB].sh_offset = shstrtab_offset;
+                sections[SEC_SHSTRTAB].sh_size = sizeof(shstrtab);
+                sections[SEC_SHSTRTAB].sh_addralign = 1;
+
+                std::string buffer(shdr_offset + sizeof(sections), '\0');
+
+                std::memcpy(&buffer[0], &header, sizeof(header));
+                std::memcpy(&buffer[text_offset], text.data(), text_size);
+                std::memcpy(&buffer[symtab_offset], symtab.data(), symtab_size);
+                std::memcpy(&buffer[strtab_offset], strtab.data(), strtab.size());
+                std::memcpy(&buffer[shstrtab_offset], shstrtab, sizeof(shstrtab));
+                std::memcpy(&buffer[shdr_offset], sections, sizeof(sections));
+
+                out.write(buffer.data(), buffer.size());
+            }
+
+        private:
+            static U64 align_to(U64 value, U64 alignment){
+                return (value + alignment - 1) & ~(alignment - 1);
+            }
+    };
+
+    /*
+        writer for a --format name, nullptr if there is none
+    */
+    inline std::unique_ptr<Code_writer> make_writer(std::string_view format){
+        if(format == "hex") return std::make_unique<Hex_writer>();
+        if(format == "bin") return std::make_unique<Bin_writer>();
+        if(format == "ihex") return std::make_unique<Ihex_writer>();
+        if(format == "elf") return std::make_unique<Elf_writer>();
+
+        return nullptr;
+    }
+
+}
@@ -1,25 +1,36 @@
-#include <unistd.h>
-#include "../include/assembler.h"
-#include "../include/lex.h"
+#include "../include/driver.h"
+#include "../include/server.h"
 
 int main(int argc, char* argv[]) {
-    std::string path = "";
 
-    for(auto& file : fs::directory_iterator(fs::path("../assembly_files"))){
+    if((argc > 1) && (std::string(argv[1]) == "run")){
+        Assembler::Run_options run_options;
 
-        if(file.is_regular_file() && (file.path().extension() == ".asm")){          
-            std::cout << "Assembling: " << file.path().string() << std::endl;  
-            std::cout << std::endl;  
-            
-            Assembler::Lexer lexer(file.path().string());
-            // lexer.print_tokens();
+        if(!Assembler::parse_run_args(argc, argv, run_options)){
+            return 2;
+        }
+
+        return Assembler::run_programs(run_options);
+    }
 
-            auto outpath = file.path();
+    Assembler::Driver_options options;
 
-            Assembler::Assembler assembler(lexer.get_tokens(), outpath);
-            assembler.run();
-        }
+    if(!Assembler::parse_args(argc, argv, options)){
+        return 2;
+    }
+
+    if(options.serve.has_value()){
+        Assembler::log_level = options.log_level;
+
+        Assembler::Options assemble_options;
+        assemble_options.verify = options.verify;
+        assemble_options.compress = options.compress;
+        assemble_options.bitmanip = options.bitmanip;
+        assemble_options.pools = options.pools;
+        assemble_options.pool_policy = options.pool_policy;
+
+        return Assembler::serve(options.serve.value(), options.jobs, assemble_options);
     }
 
-    return 0;
-}
\ No newline at end of file
+    return Assembler::Driver(options).run();
+}
@@ -0,0 +1,60 @@
+/*
+    Immediates of I and S type instructions through assemble(): a number outside the signed 12 bits fails with
+    a diagnostic at the immediate, numbers at the ends of the range and labels assemble
+*/
+
+#include <cstdio>
+#include "api.h"
+
+namespace {
+
+    int failures = 0;
+
+    void check(bool condition, const std::string& what){
+        if(!condition){
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            failures += 1;
+        }
+    }
+
+    Assembler::Result assemble_line(const std::string& line){
+        return Assembler::assemble("main:\n    " + line + "\nlabel:\n    ret\n");
+    }
+
+    void rejects(const std::string& line, const std::string& diagnostic){
+        Assembler::Result result = assemble_line(line);
+
+        check(!result.ok, "`" + line + "` fails");
+        check(result.diagnostics.find(diagnostic) != std::string::npos, "`" + line + "` reports `" + diagnostic + "`, got: " + result.diagnostics);
+    }
+
+    void accepts(const std::string& line, U32 word){
+        Assembler::Result result = assemble_line(line);
+
+        check(result.ok, "`" + line + "` assembles: " + result.diagnostics);
+        check(!result.code.empty() && (result.code[0] == word), "`" + line + "` encodes to its word");
+    }
+
+}
+
+int main(){
+    rejects("addi a0, a0, 5000", "2:18: error: Immediate 5000 does not fit in 12 bits");
+    rejects("andi a0, a0, 0xfff", "2:18: error: Immediate 4095 does not fit in 12 bits");
+    rejects("lw a0, 5000(a1)", "2:12: error: Immediate 5000 does not fit in 12 bits");
+    rejects("sw a0, -2049(a1)", "2:12: error: Immediate -2049 does not fit in 12 bits");
+
+    accepts("addi a0, a0, -2048", 0x80050513);
+    accepts("addi a0, a0, 2047", 0x7ff50513);
+    accepts("lw a0, -2048(a1)", 0x8005a503);
+    accepts("sw a0, 2047(a1)", 0x7ea5afa3);
+    // shift amounts have their own width and only warn
+    accepts("slli a0, a0, 63", 0x03f51513);
+    // a label is patched in later, its address is checked there
+    accepts("lw a0, label(a1)", 0x0045a503);
+
+    if(failures == 0){
+        std::printf("api_test passed\n");
+    }
+
+    return failures ? 1 : 0;
+}
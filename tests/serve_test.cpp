@@ -0,0 +1,129 @@
+/*
+    Sends a request that needs a literal pool to serve_connection with --compress and --literal-pools, and checks
+    that the response frame carries the pool as a data range and that the pool number survives packing the
+    words into bytes
+*/
+
+#include <sys/socket.h>
+#include <cstdio>
+#include <thread>
+#include "server.h"
+
+namespace {
+
+    int failures = 0;
+
+    void check(bool condition, const std::string& what){
+        if(!condition){
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            failures += 1;
+        }
+    }
+
+    struct Response {
+        bool ok = false;
+        std::vector<U32> code;
+        std::vector<Assembler::Data_range> data;
+        std::string diagnostics;
+    };
+
+    bool read_response(int fd, Response& response){
+        char header[16];
+
+        if(!Assembler::read_exact(fd, header, sizeof(header))) return false;
+
+        response.ok = Assembler::get_u32(header);
+        response.code.resize(Assembler::get_u32(header + 4));
+        response.data.resize(Assembler::get_u32(header + 8));
+        response.diagnostics.resize(Assembler::get_u32(header + 12));
+
+        std::string body(response.code.size() * 4 + response.data.size() * 8, '\0');
+
+        if(!Assembler::read_exact(fd, body.data(), body.size())) return false;
+
+        for(size_t i = 0; i < response.code.size(); ++i){
+            response.code[i] = Assembler::get_u32(body.data() + 4 * i);
+        }
+
+        const char* ranges = body.data() + response.code.size() * 4;
+
+        for(size_t i = 0; i < response.data.size(); ++i){
+            response.data[i] = Assembler::Data_range{Assembler::get_u32(ranges + 8 * i), Assembler::get_u32(ranges + 8 * i + 4)};
+        }
+
+        return Assembler::read_exact(fd, response.diagnostics.data(), response.diagnostics.size());
+    }
+
+}
+
+int main(){
+    const std::string source =
+        "main:\n"
+        "    li a0, 0x123456789abcdef0\n"
+        "    addi a0, a0, 1\n"
+        "    ret\n";
+    const uint64_t number = 0x123456789abcdef0;
+
+    Assembler::Options options;
+    options.compress = true;
+    options.pools = Assembler::POOLS_PER_FUNCTION;
+
+    int fds[2];
+
+    if(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0){
+        std::perror("socketpair");
+        return 1;
+    }
+
+    std::thread server([&]{
+        Assembler::serve_connection(fds[1], fds[1], options);
+        ::close(fds[1]);
+    });
+
+    std::string request;
+    Assembler::put_u32(request, source.size());
+    request += source;
+
+    Response response;
+    bool answered = Assembler::write_all(fds[0], request.data(), request.size()) && read_response(fds[0], response);
+
+    ::close(fds[0]);
+    server.join();
+
+    check(answered, "the server answers the request");
+    check(response.ok, "the request assembles: " + response.diagnostics);
+
+    Assembler::Result expected = Assembler::assemble(source, options);
+
+    check(response.code == expected.code, "the response has the words of assemble()");
+    check((response.data.size() == 1) && (expected.data.size() == 1), "the response has the one data range of assemble()");
+
+    if((response.data.size() == 1) && (expected.data.size() == 1)){
+        const Assembler::Data_range& pool = response.data[0];
+
+        check((pool.begin == expected.data[0].begin) && (pool.end == expected.data[0].end), "the data range is the one of assemble()");
+        check(pool.end - pool.begin >= 2, "the pool holds the 64 bit number");
+
+        // the instructions in front of the pool are 2 or 4 bytes, the pool number comes after them in 8 bytes
+        size_t offset = 0;
+
+        for(size_t i = 0; i < pool.begin; ++i){
+            offset += Assembler::instruction_size(response.code[i]);
+        }
+
+        std::string bytes = Assembler::code_bytes(response.code, response.data);
+        std::string wanted;
+
+        for(int byte = 0; byte < 8; ++byte){
+            wanted += (char)((number >> (8 * byte)) & 0xff);
+        }
+
+        check(bytes.compare(offset, 8, wanted) == 0, "the pool number is at its place in the packed bytes");
+    }
+
+    if(failures == 0){
+        std::printf("serve_test passed\n");
+    }
+
+    return failures ? 1 : 0;
+}